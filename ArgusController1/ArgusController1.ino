@@ -17,22 +17,38 @@
 // start user configuration
 //=============================================================================
 #define DEVICE_ID 1    // Argus Monitor can manage up to 4 different Argus Controller devices, each must have an unique Device ID
+                       // default, if no device id is stored in EEPROM (EEADDR_DEVICE_ID), also the address on a multi-drop bus
 
-#define TEMPERATURE_ONEWIRE    // activate for 1-wire temperature sensors DS18B20, deactivate for 10k-NTC temperature sensors
+#define TEMPSENSOR_COUNT 4    // number of temperature channels, one descriptor per channel in TEMP_CHANNELS
 
-#define TEMPSENSOR_COUNT 4    // number of temperature sensors
-// #define TEMPSENSOR_COUNT 2    // example for 2 temperature sensors only, see also line 60
+// temperature channels: Ds18b20Channel<pin>, NtcChannel<analog pin, thermistor type>, FakeChannel<temperature x10>, see tempsensors.h
+// DS18B20 channels may share a pin, the sensors on a pin are assigned in 1-wire search order
+#define TEMP_CHANNELS Ds18b20Channel<A0>, Ds18b20Channel<A1>, Ds18b20Channel<A2>, Ds18b20Channel<A3>
+// example for 10k NTC sensors:
+// #define TEMP_CHANNELS NtcChannel<A0>, NtcChannel<A1>, NtcChannel<A2, NTC_10K_3950>, NtcChannel<A3, NTC_10K_3950>
+// example for water loop NTCs and 2 air DS18B20 sensors on one pin:
+// #define TEMP_CHANNELS NtcChannel<A0>, NtcChannel<A1>, Ds18b20Channel<A2>, Ds18b20Channel<A2>
 
-#define PIN_TEMPSENSOR_1 A0    // temperature sensor pins, any Arduino pin for DS18B20 sensors, analog Arduino pin for NTC sensors
-#define PIN_TEMPSENSOR_2 A1
-#define PIN_TEMPSENSOR_3 A2
-#define PIN_TEMPSENSOR_4 A3
+#define FAN_COUNT 2    // number of fan channels, one FanChannel descriptor per fan in FAN_CHANNELS
 
-#define FAN_COUNT 2
+// fan channels: FanChannel<pwm output, tach pin, pwm inverted, tach pulses per revolution>, see fanctrl.h
+// pwm outputs: FANPWM_OC1A (pin 9), FANPWM_OC1B (pin 10), FANPWM_OC2B (pin 3), fans may share a pwm output
+// tach pins 2 and 3 use INT0/INT1, any other free pin uses a pin change interrupt
+#define FAN_CHANNELS FanChannel<FANPWM_OC1A, 2, true, 2>, FanChannel<FANPWM_OC1B, 3, true, 2>
+// example for 6 fans, two fans on each pwm output:
+// #define FAN_CHANNELS FanChannel<FANPWM_OC1A, 2>, FanChannel<FANPWM_OC1A, 4>, FanChannel<FANPWM_OC1B, 5>, FanChannel<FANPWM_OC1B, 6>, FanChannel<FANPWM_OC2B, 7>, FanChannel<FANPWM_OC2B, 8>
+
+#define SENSOR_SAMPLE_PERIOD 0    // ms between temperature measurements, 0 = measure continuously
+
+#define HISTORY_SIZE 16        // samples in the history ring, SRAM: HISTORY_SIZE * (TEMPSENSOR_COUNT + FAN_COUNT + 1) * 2 bytes
+#define HISTORY_PERIOD 1000    // ms, min. time between history samples, 0 = every temperature measurement
+
+#define FAILSAFE_TIMEOUT 10    // s without a valid host message until the fans run their failsafe pwm, see EEADDR_FAILSAFE_TIMEOUT
 
 //#define DEBUG_OUTPUT    // print some debug output via serial port
-//#define FAKE_SENSORS
-// #define PIN_LED 13 // Arduino Nano built-in LED, free to use
+//#define FAKE_SENSORS    // fake fan rpms, see FakeChannel for fake temperatures
+// #define PIN_LED 13 // Arduino Nano built-in LED, free to use, on while an alarm (failsafe, fan stall) is active
+// #define PIN_RS485_DE 4 // transmitter enable (DE, /RE) of a RS-485 transceiver on a multi-drop bus
 //=============================================================================
 // end user configuration
 
@@ -42,29 +58,95 @@
 #include "src/debug.h"
 // clang-format on
 #include "src/amcom.h"
-#include "src/ds18b20.h"
-#include "src/ntcsensor.h"
+#include "src/tempsensors.h"
 #include "src/fanctrl.h"
+#include "src/fancurve.h"
+#include "src/perfstat.h"
+#include "src/eewriter.h"
+#include "src/history.h"
+#include "src/scheduler.h"
 #include <EEPROM.h>
+#include <avr/wdt.h>
 
 AMCOM<DEVICE_ID, TEMPSENSOR_COUNT, FAN_COUNT> amCom;
 
-#ifdef TEMPERATURE_ONEWIRE
-DS18B20 ds18Sensor[TEMPSENSOR_COUNT];
+TEMPSENSORS<TEMP_CHANNELS> tempSensors;
+
 bool    ds18SensorPresent[TEMPSENSOR_COUNT];
-#else
-NTCSENSOR ntcSensor;
-#endif
+uint8_t ds18Rescan     = 0;       // bit n set: assign the sensors of bus n again, see CmdRescanSensors
+bool    ds18RescanKeep = true;    // keep the sensors of the stored ROM codes
+uint8_t ds18RomDirty   = 0;       // bit n set: ROM code of channel n to be stored in EEPROM
+
+FANCTRL<FAN_CHANNELS> fanctrl;
+uint8_t               fanGainDirty = 0;    // bit n set: PID gains of fan n to be stored in EEPROM
+static_assert(decltype(fanctrl)::count == FAN_COUNT, "FAN_CHANNELS must have FAN_COUNT descriptors");
+static_assert(AMCOM_BLOCK_SIZE <= EEWRITER_BLOCK_SIZE, "EEWriteBlock data must fit into the EEPROM writer");
+static_assert(decltype(tempSensors)::count == TEMPSENSOR_COUNT, "TEMP_CHANNELS must have TEMPSENSOR_COUNT descriptors");
+static_assert(TEMPSENSOR_COUNT <= 6, "up to 6 temperature channels, see EEADDR_ROM_0");
+static_assert(FANCURVE_EE_SIZE <= EESIZE_FANCURVE, "fan curve does not fit into its EEPROM range");
+static_assert(FANCURVE_EE_SIZE <= EEWRITER_BLOCK_SIZE, "fan curve must be written as one block");
+
+FANCURVE      fanCurve[FAN_COUNT];
+uint8_t       fanCurveDirty = 0;        // bit n set: fan curve n to be stored in EEPROM
+EEWRITER      eeWriter;                 // background EEPROM writes of EEWriteByte, EEWriteBlock and changed settings
+bool          eeWriteHost = false;      // the block being written comes from the host, see eepromWritten()
+uint8_t       buffer[40];               // allocate only once
+unsigned long sampleTime        = 0;
+uint8_t       sampleSequence    = 0;    // incremented with every new temperature measurement
+uint8_t       processedSequence = 0;    // last sample processed by the fan curves and telemetry
+unsigned long lastSampleTime    = 0;    // time stamp of the last processed sample
+
+// streaming telemetry, enabled by the host with CmdSetStream
+uint8_t       streamKeepAlive    = 0;    // s, max. time between telemetry frames, 0 = streaming off
+uint8_t       streamTempDeadband = 0;    // 0.1C, smaller temperature changes are not reported
+uint8_t       streamRpmDeadband  = 0;    // rpm, smaller rpm changes are not reported
+unsigned long streamTime         = 0;    // time stamp of the last telemetry frame
+int16_t       streamTemp[TEMPSENSOR_COUNT];
+uint16_t      streamRpm[FAN_COUNT];
+uint8_t       streamAlarm = 0;    // alarm bits of the last telemetry frame
+
+// sample history, channels: temperatures, rpms, time stamp [0.1s], see CmdGetHistory
+#define HISTORY_CHANNELS (TEMPSENSOR_COUNT + FAN_COUNT + 1)
+HISTORY<HISTORY_CHANNELS, HISTORY_SIZE> history;
+unsigned long historyTime = 0;    // time stamp of the last history sample
 
-const uint8_t sensorPin[TEMPSENSOR_COUNT] = { PIN_TEMPSENSOR_1, PIN_TEMPSENSOR_2, PIN_TEMPSENSOR_3, PIN_TEMPSENSOR_4 };
-// const uint8_t sensorPin[TEMPSENSOR_COUNT] = { PIN_TEMPSENSOR_1, PIN_TEMPSENSOR_2 };    // example for 2 temperature sensors only
+// host link watchdog
+uint8_t failsafeTimeout = FAILSAFE_TIMEOUT;    // s, 0 = off
+uint8_t failsafePwm[FAN_COUNT];                // %, > 100: fan curve
+bool    failsafeActive = false;
+uint8_t alarm          = 0;    // AMAC_ALARM bits
 
-FANCTRL fanctrl;
-uint8_t buffer[20];    // allocate only once
+// performance counters, see CmdGetStats
+PERFSTAT loopStat;    // busy time of a scheduler pass
+
+// cooperative tasks, run by the scheduler in table order, see scheduler.h
+void taskService();
+void taskWatchdog();
+void taskEEPROM();
+void taskSensors();
+void taskFans();
+void taskSamples();
+
+const SchedulerTask taskTable[] PROGMEM = {
+    { taskService, 0 },    // deadline task, runs between all other tasks: ProbeDevice is answered within the longest task run time
+    { taskWatchdog, 100 },
+    { taskEEPROM, 0 },
+    { taskSensors, 0 },
+    { taskFans, FANCTRL_UPDATE_PERIOD },
+    { taskSamples, 0 },
+};
+SCHEDULER<sizeof(taskTable) / sizeof(taskTable[0])> scheduler(taskTable);
 
 //---------------------------------------------------------
 void setup()
 {
+    // a hang ended by the hardware watchdog is reported to the host (with bootloaders keeping MCUSR)
+    if (MCUSR & (1 << WDRF)) {
+        alarm |= AlarmWatchdog;
+    }
+    MCUSR = 0;
+    wdt_disable();
+
     delay(200);
 
     // flash LED on App start
@@ -78,161 +160,865 @@ void setup()
     }
 #endif
 
-    Serial.begin(57600);
+    amCom.begin();
+    amCom.setAddress(EEPROM.read(EEADDR_DEVICE_ID));
 
     dbgPrintln("");
-    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
-#ifdef TEMPERATURE_ONEWIRE
-        dbgPrint("Channel ");
-        dbgDec(i + 1);
-        dbgPrint(": ");
-        ds18SensorPresent[i] = ds18Sensor[i].init(sensorPin[i]);
-#else
-        ntcSensor.addPin(sensorPin[i]);
-#endif
+    tempSensors.begin(SENSOR_SAMPLE_PERIOD);
+    for (uint8_t bus = 0; bus < tempSensors.busCount(); bus++) {
+        assignSensors(bus, true);    // stored sensors, a search only if one is missing
+    }
+
+    fanctrl.init();
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        fanCurve[i].load(EEADDR_FANCURVE_0 + i * EESIZE_FANCURVE);
     }
+    loadFailsafe();
 
-    fanctrl.init(FAN_COUNT);
+    wdt_enable(WDTO_2S);    // reset, if a task hangs
+    scheduler.begin();
 }
 
 //---------------------------------------------------------
 void loop()
 {
-    // 1-wire meassure start
-#ifdef TEMPERATURE_ONEWIRE
-    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
-        if (ds18SensorPresent[i]) {    // process only avalilable sensors
-            ds18Sensor[i].start();
+    unsigned long start = micros();
+    scheduler.run();
+    loopStat.add(micros() - start);
+    if (Serial.available() == 0) {    // bytes received after the last service run are processed at once
+        scheduler.sleep();            // until the next interrupt
+    }
+}
+
+//---------------------------------------------------------
+// host messages and answers, ProbeDevice and SetBaud are answered by amCom.service() at once
+void taskService()
+{
+    amCom.service();
+    processCommands();
+}
+
+void taskWatchdog()
+{
+    wdt_reset();
+}
+
+void taskEEPROM()
+{
+    // settings written by the device itself are already applied, only host writes are applied once written
+    if (eeWriter.update() && eeWriteHost) {
+        eeWriteHost = false;
+        eepromWritten(eeWriter.address(), eeWriter.count());
+    }
+    for (uint8_t i = 0; (i < TEMPSENSOR_COUNT) && (ds18RomDirty != 0) && !eeWriter.busy(); i++) {
+        if (ds18RomDirty & (1 << i)) {
+            ds18RomDirty &= ~(1 << i);
+            eeWriter.start(EEADDR_ROM_0 + i * EESIZE_ROM, tempSensors.ds18b20(i).rom(), EESIZE_ROM);
+        }
+    }
+    for (uint8_t i = 0; (i < FAN_COUNT) && (fanCurveDirty != 0) && !eeWriter.busy(); i++) {
+        if (fanCurveDirty & (1 << i)) {
+            fanCurveDirty &= ~(1 << i);
+            uint8_t image[FANCURVE_EE_SIZE];
+            eeWriter.start(fanCurve[i].address(), image, fanCurve[i].image(image));
+        }
+    }
+    for (uint8_t i = 0; (i < FAN_COUNT) && (fanGainDirty != 0) && !eeWriter.busy(); i++) {
+        if (fanGainDirty & (1 << i)) {
+            fanGainDirty &= ~(1 << i);
+            uint8_t image[6];
+            for (uint8_t g = 0; g < 3; g++) {
+                uint16_t gain    = fanctrl.getGain(i, g);
+                image[2 * g]     = gain & 0xFF;    // low byte first, like EEPROM.put()
+                image[2 * g + 1] = gain >> 8;
+            }
+            eeWriter.start(EEADDR_PID_0 + i * EESIZE_PID, image, sizeof(image));
         }
     }
+}
+
+// temperature sensors, every DS18B20 is read as soon as the conversion of its bus is complete
+// the code of a sensor type without channels is removed by the compiler
+void taskSensors()
+{
+    if (tempSensors.ds18Count > 0) {
+        if (ds18Rescan != 0) {    // one bus per run, bounds the run time of the task
+            uint8_t bus = 0;
+            while (!(ds18Rescan & (1 << bus))) {
+                bus++;
+            }
+            ds18Rescan &= ~(1 << bus);
+            assignSensors(bus, ds18RescanKeep);
+            return;
+        }
+        for (uint8_t bus = 0; bus < tempSensors.busCount(); bus++) {    // missing sensors, with backoff: bounded bus time for dead channels
+            DS18B20BUS& ds18Bus = tempSensors.bus(bus);
+            if ((ds18Bus.count() < tempSensors.busChannels(bus)) && ds18Bus.probeDue()) {
+                probeSensors(bus);
+                return;
+            }
+        }
+        for (uint8_t bus = 0; bus < tempSensors.busCount(); bus++) {
+            uint8_t lost;
+            if (tempSensors.pollDs18b20(bus, lost)) {
+                if (lost != 0) {
+                    dbgPrintln("sensor lost");
+                    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+                        if (lost & (1 << i)) {
+                            ds18SensorPresent[i] = false;
+                        }
+                    }
+                    tempSensors.bus(bus).scheduleProbe(false);
+                }
+                printTemperatures(tempSensors.busMask(bus));
+                sampleSequence++;
+            }
+        }
+    }
+    if (tempSensors.ntcCount > 0) {
+#if SENSOR_SAMPLE_PERIOD > 0
+        bool due = (millis() - sampleTime) >= SENSOR_SAMPLE_PERIOD;
+#else
+        bool due = true;    // measure continuously
 #endif
+        if (due && tempSensors.pollNtc()) {    // ADC is scanned in the background
+            sampleTime = millis();
+            printTemperatures(tempSensors.ntcMask);
+            sampleSequence++;
+        }
+    }
+}
 
-    // 1-wire wait time (1.1sec DS18B20 max. conversion time, resolution dependent)
-    for (uint8_t i = 0; i < 11; i++) {
-        amCom.delay(100);
-        processCommands();
+// telemetry also with every rpm update: keep alive, rpm and alarm changes without temperature measurements
+void taskFans()
+{
+    fanctrl.update();
+    updateAlarm();
+    if ((streamKeepAlive > 0) && !amCom.busMode()) {
+        streamTelemetry();
     }
+}
 
-    // temperature sensors read
-#ifdef TEMPERATURE_ONEWIRE
+// fan curves, history and telemetry after a new measurement
+void taskSamples()
+{
+    if (processedSequence != sampleSequence) {
+        processedSequence = sampleSequence;
+        lastSampleTime    = millis();
+        updateFanCurves();
+        if ((history.count() == 0) || ((lastSampleTime - historyTime) >= HISTORY_PERIOD)) {
+            recordHistory();
+        }
+        if ((streamKeepAlive > 0) && !amCom.busMode()) {    // no unsolicited messages on a shared bus
+            streamTelemetry();
+        }
+    }
+}
+
+//---------------------------------------------------------
+void updateFanCurves()
+{
+    // autonomous fans follow their curve right after each new measurement
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        if (fanCurve[i].autonomous() || (failsafeActive && (failsafePwm[i] > 100) && fanCurve[i].valid())) {
+            uint8_t source = fanCurve[i].source();
+            bool    valid  = (source < TEMPSENSOR_COUNT) && temperatureValid(source);
+            fanctrl.setPwm(i, fanCurve[i].update(valid ? getTemperature(source) : 0, valid));
+        }
+    }
+}
+
+//---------------------------------------------------------
+void recordHistory()
+{
+    int16_t values[HISTORY_CHANNELS];
     for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
-        if (ds18SensorPresent[i]) {    // process only avalilable sensors
-            ds18Sensor[i].read();
+        values[i] = getTemperature(i);
+    }
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        values[TEMPSENSOR_COUNT + i] = getRpm(i);
+    }
+    values[TEMPSENSOR_COUNT + FAN_COUNT] = lastSampleTime / 100;    // wraps around, the host uses the differences
+    historyTime                          = lastSampleTime;
+    history.add(values);
+}
+
+//---------------------------------------------------------
+void loadFailsafe()
+{
+    // failsafe settings from EEPROM, changed with CmdEEWriteByte
+    uint8_t timeout = EEPROM.read(EEADDR_FAILSAFE_TIMEOUT);
+    failsafeTimeout = (timeout != 0xFF) ? timeout : FAILSAFE_TIMEOUT;
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        failsafePwm[i] = EEPROM.read(EEADDR_FAILSAFE_PWM_0 + i);
+    }
+}
+
+//---------------------------------------------------------
+// settings changed by the host with EEWriteByte or EEWriteBlock are applied once written
+void eepromWritten(uint16_t addr, uint8_t count)
+{
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if ((addr <= EEADDR_TEMP_RESOLUTION_0 + i) && (addr + count > EEADDR_TEMP_RESOLUTION_0 + i)) {
+            setResolution(i);
         }
     }
-#else
-    ntcSensor.read();
+    if ((addr < EEADDR_FAILSAFE_PWM_0 + FAN_COUNT) && (addr + count > EEADDR_FAILSAFE_TIMEOUT)) {
+        loadFailsafe();
+    }
+    if ((addr <= EEADDR_DEVICE_ID) && (addr + count > EEADDR_DEVICE_ID)) {
+        amCom.setAddress(EEPROM.read(EEADDR_DEVICE_ID));
+    }
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        uint16_t curveAddr = EEADDR_FANCURVE_0 + i * EESIZE_FANCURVE;
+        if ((addr < curveAddr + EESIZE_FANCURVE) && (addr + count > curveAddr)) {
+            fanCurve[i].load(curveAddr);
+            fanCurveDirty &= ~(1 << i);    // the host write replaces changes not yet stored
+        }
+        uint16_t pidAddr = EEADDR_PID_0 + i * EESIZE_PID;
+        if ((addr < pidAddr + EESIZE_PID) && (addr + count > pidAddr)) {
+            fanctrl.loadGains(i);
+            fanGainDirty &= ~(1 << i);
+        }
+    }
+}
+
+//---------------------------------------------------------
+void updateAlarm()
+{
+    // host link lost: host mode fans run their failsafe pwm, fans without one follow their curve or run at 100%
+    bool linkLost = (failsafeTimeout > 0) && amCom.linkTimeout(failsafeTimeout * 1000UL);
+    if (linkLost && !failsafeActive) {
+        dbgPrintln("host link lost, failsafe");
+        for (uint8_t i = 0; i < FAN_COUNT; i++) {
+            if (!fanCurve[i].autonomous()) {
+                if (failsafePwm[i] <= 100) {
+                    fanctrl.setPwm(i, failsafePwm[i]);
+                } else if (!fanCurve[i].valid()) {
+                    fanctrl.setPwm(i, 100);
+                }
+            }
+        }
+    }
+    failsafeActive = linkLost;
+
+    uint8_t state = alarm & AlarmWatchdog;
+    if (failsafeActive) {
+        state |= AlarmFailsafe;
+    }
+    if (fanctrl.stallMask() != 0) {
+        state |= AlarmStall;
+    }
+#ifdef PIN_LED
+    if ((state & (AlarmFailsafe | AlarmStall)) != (alarm & (AlarmFailsafe | AlarmStall))) {
+        digitalWrite(PIN_LED, (state & (AlarmFailsafe | AlarmStall)) ? HIGH : LOW);
+    }
 #endif
+    alarm = state;
+}
+
+//---------------------------------------------------------
+void streamTelemetry()
+{
+    // send a telemetry frame if any value changed more than its deadband or the keep alive time elapsed
+    bool changed = (millis() - streamTime) >= (streamKeepAlive * 1000UL);
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        // a lost or found sensor is always a change, the int32_t difference does not overflow with TEMPERATURE_INVALID
+        int16_t temperature = getTemperature(i);
+        bool    validChange = (temperature == TEMPERATURE_INVALID) != (streamTemp[i] == TEMPERATURE_INVALID);
+        if (validChange || (abs((int32_t)temperature - streamTemp[i]) > streamTempDeadband)) {
+            changed = true;
+        }
+    }
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        if (abs((int32_t)getRpm(i) - streamRpm[i]) > streamRpmDeadband) {
+            changed = true;
+        }
+    }
+    if (alarm != streamAlarm) {
+        changed = true;
+    }
 
-    // debug output
+    if (changed && amCom.sendReady()) {
+        for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+            streamTemp[i] = getTemperature(i);
+        }
+        for (uint8_t i = 0; i < FAN_COUNT; i++) {
+            streamRpm[i] = getRpm(i);
+        }
+        streamAlarm = alarm;
+        streamTime  = millis();
+        amCom.send(buffer, buildSnapshot(AMAC_CMD::CmdTelemetry));
+    }
+}
+
+//---------------------------------------------------------
+// tach inputs on pin change interrupts
+ISR(PCINT0_vect)
+{
+    fanctrl.pcint(0);
+}
+
+ISR(PCINT1_vect)
+{
+    fanctrl.pcint(1);
+}
+
+ISR(PCINT2_vect)
+{
+    fanctrl.pcint(2);
+}
+
+//---------------------------------------------------------
+// background scan of the NTC channels, the ADC interrupt is enabled only with NTC channels
+ISR(ADC_vect)
+{
+    tempSensors.ntc().isr();
+}
+
+//---------------------------------------------------------
+// bit n set: channel n
 #ifdef DEBUG_OUTPUT
-    dbgPrintln("");
+void printTemperatures(uint8_t mask)
+{
     for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
-        int16_t temp = 0;
-#ifdef TEMPERATURE_ONEWIRE
-        if (ds18SensorPresent[i]) {    // process only avalilable sensors
-            temp = ds18Sensor[i].temperature();
+        if (mask & (1 << i)) {
+            dbgPrint("Channel ");
+            dbgDec(i + 1);
+            dbgPrint(" temperature x10: ");
+            dbgDec(tempSensors.temperature(i));
+            dbgPrintln(" C");
         }
+    }
+}
 #else
-        temp = ntcSensor.temperature(i);
+void printTemperatures(uint8_t) {}
 #endif
-        dbgPrint("Channel ");
-        dbgDec(i + 1);
-        dbgPrint(" temperature x10: ");
-        dbgDec(temp);
-        dbgPrintln(" C");
+
+//---------------------------------------------------------
+// sensors of all channels on a bus, at startup and with RescanSensors: the bus starts over without sensors
+void assignSensors(uint8_t bus, bool keep)
+{
+    DS18B20BUS& ds18Bus = tempSensors.bus(bus);
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if (tempSensors.channelBus(i) == bus) {
+            ds18SensorPresent[i] = false;
+            tempSensors.ds18b20(i).detach();
+        }
     }
-#endif
+    ds18Bus.begin(ds18Bus.pin());    // after the detach, restarts the device count
+    attachSensors(bus, keep);
+}
 
-    // additional loop wait time befor next meassurement
-    // wait 1sec while receiving
-    for (uint8_t i = 0; i < 10; i++) {
-        amCom.delay(100);
-        processCommands();
+// missing sensors of a bus (backoff re-probe): the answering sensors stay attached and keep their temperature
+void probeSensors(uint8_t bus)
+{
+    if (attachSensors(bus, true) != 0) {
+        tempSensors.bus(bus).restart();    // new sensors convert before their first read
     }
+}
 
-    fanctrl.update();
+// free channels of a bus: with keep, the sensors of the stored ROM codes (Match ROM read, no search),
+// the channels still free get the sensors found by a search in search order, their ROM codes are stored
+// returns the mask of the channels attached
+uint8_t attachSensors(uint8_t bus, bool keep)
+{
+    DS18B20BUS& ds18Bus  = tempSensors.bus(bus);
+    uint8_t     free     = 0;
+    uint8_t     attached = 0;
+    uint8_t     rom[EESIZE_ROM];
+    ds18Bus.oneWire().reset_search();
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if ((tempSensors.channelBus(i) == bus) && !ds18SensorPresent[i]) {
+            for (uint8_t b = 0; b < EESIZE_ROM; b++) {
+                rom[b] = EEPROM.read(EEADDR_ROM_0 + i * EESIZE_ROM + b);
+            }
+            ds18SensorPresent[i] = keep && !romAssigned(rom) && tempSensors.ds18b20(i).attach(ds18Bus, rom);
+            if (ds18SensorPresent[i]) {
+                attached |= 1 << i;
+            } else {
+                free++;
+                if (!keep) {
+                    ds18RomDirty |= 1 << i;    // forget the stored ROM code, unless a sensor is found
+                }
+            }
+        }
+    }
+    while ((free > 0) && ds18Bus.search(rom)) {
+        if (romAssigned(rom)) {
+            continue;    // sensor already attached
+        }
+        for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+            if ((tempSensors.channelBus(i) == bus) && !ds18SensorPresent[i]) {
+                ds18SensorPresent[i] = tempSensors.ds18b20(i).attach(ds18Bus, rom);
+                if (ds18SensorPresent[i]) {
+                    ds18RomDirty |= 1 << i;
+                    attached |= 1 << i;
+                    free--;
+                }
+                break;
+            }
+        }
+    }
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if (attached & (1 << i)) {
+            dbgPrint("Channel ");
+            dbgDec(i + 1);
+            dbgPrintln(": sensor");
+            setResolution(i);
+        }
+    }
+    ds18Bus.scheduleProbe(free > 0);    // next probe of missing sensors
+    return attached;
+}
+
+bool romAssigned(const uint8_t* rom)
+{
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if (ds18SensorPresent[i] && (memcmp(tempSensors.ds18b20(i).rom(), rom, EESIZE_ROM) == 0)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 //---------------------------------------------------------
-void processCommands()
+void setResolution(uint8_t channel)
 {
-    if (amCom.queueCount() > 0) {
-        uint32_t qdata = amCom.queuePop();
-        uint8_t  cmd   = qdata & 0xFF;
-        uint8_t  channel;
-        switch (cmd) {
-        case AMAC_CMD::CmdGetTemp:
-            buffer[0] = cmd;
-            buffer[1] = TEMPSENSOR_COUNT;
-            for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
-                int16_t temperature;
-#ifdef FAKE_SENSORS
-                temperature = 305 + 10 * i;    // 30.5C + i
-#elif defined TEMPERATURE_ONEWIRE
-                temperature = ds18Sensor[i].temperature();
-#else
-                temperature = ntcSensor.temperature(i);
-#endif
-                buffer[2 + i * 2] = temperature >> 8;
-                buffer[3 + i * 2] = temperature & 0xFF;
+    // DS18B20 resolution from EEPROM
+    // you can change the resolution from within Argus Monitor and store it to EEPROM permanently
+    if (ds18SensorPresent[channel]) {
+        tempSensors.ds18b20(channel).setResolution(EEPROM.read(EEADDR_TEMP_RESOLUTION_0 + channel));    // invalid values are ignored
+    }
+
+    // conversion timeout of each bus follows its slowest sensor
+    for (uint8_t bus = 0; bus < tempSensors.busCount(); bus++) {
+        uint16_t conversionTime = 0;
+        for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+            if (ds18SensorPresent[i] && (tempSensors.channelBus(i) == bus)) {
+                conversionTime = max(conversionTime, tempSensors.ds18b20(i).conversionTime());
             }
-            amCom.send(buffer, 2 + 2 * TEMPSENSOR_COUNT);
-            break;
-        case AMAC_CMD::CmdGetFanRpm:
-            buffer[0] = cmd;
-            buffer[1] = FAN_COUNT;
-            for (uint8_t i = 0; i < FAN_COUNT; i++) {
-                uint16_t rpm;
+        }
+        tempSensors.bus(bus).setConversionTime(conversionTime);
+    }
+}
+
+//---------------------------------------------------------
+int16_t getTemperature(uint8_t channel)
+{
+    return tempSensors.temperature(channel);
+}
+
+bool temperatureValid(uint8_t channel)
+{
+    return (channel < TEMPSENSOR_COUNT) && (getTemperature(channel) != TEMPERATURE_INVALID);
+}
+
+uint16_t getRpm(uint8_t channel)
+{
 #ifdef FAKE_SENSORS
-                rpm = 2000 + 100 * i;
+    return 2000 + 100 * channel;
 #else
-                rpm         = fanctrl.getRpm(i);
+    return fanctrl.getRpm(channel);
 #endif
-                buffer[2 + i * 2] = rpm >> 8;
-                buffer[3 + i * 2] = rpm & 0xFF;
-            }
-            amCom.send(buffer, 2 + 2 * FAN_COUNT);
-            break;
-        case AMAC_CMD::CmdGetFanPwm:
-            channel   = (qdata >> 8) & 0xFF;
-            buffer[0] = cmd;
-            buffer[1] = channel;
-            buffer[2] = fanctrl.getPwm(channel);
-            amCom.send(buffer, 3);
-            break;
-        case AMAC_CMD::CmdSetFanPwm: {
-            channel     = (qdata >> 8) & 0xFF;
-            uint8_t pwm = (qdata >> 16) & 0xFF;
-            if (fanctrl.setPwm(channel, pwm)) {
-                buffer[0] = cmd;    // ok code
-            } else {
-                buffer[0] = 0xFF;    // error code
-            }
-            amCom.send(buffer, 1);
-            break;
+}
+
+//---------------------------------------------------------
+// GetAll and Telemetry payload, returns the payload length
+uint8_t buildSnapshot(uint8_t cmd)
+{
+    uint8_t len     = 0;
+    uint8_t status  = tempSensors.validMask();
+    buffer[len++]   = cmd;
+    buffer[len++]   = sampleSequence;
+    uint8_t posStat = len++;
+    buffer[len++]   = TEMPSENSOR_COUNT;
+    tempSensors.encode(&buffer[len]);
+    len += 2 * TEMPSENSOR_COUNT;
+    if (alarm & (AlarmFailsafe | AlarmStall)) {
+        status |= 0x80;
+    }
+    buffer[posStat] = status;
+    buffer[len++]   = FAN_COUNT;
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        uint16_t rpm  = getRpm(i);
+        buffer[len++] = rpm >> 8;
+        buffer[len++] = rpm & 0xFF;
+    }
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        buffer[len++] = fanctrl.getPwm(i);
+    }
+    return len;
+}
+
+//---------------------------------------------------------
+// command handlers, qdata: cmd and parameters as queued by AMCOM
+void cmdGetCaps(uint32_t qdata)
+{
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = 2;    // CAPS bytes
+    buffer[2] = AMAC_CAPABILITIES;
+    buffer[3] = AMAC_CAPABILITIES1 | ((tempSensors.ds18Count > 0) ? CapRescan : 0);
+    amCom.send(buffer, 4);
+}
+
+void cmdGetTemp(uint32_t qdata)
+{
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = TEMPSENSOR_COUNT;
+    tempSensors.encode(&buffer[2]);
+    amCom.send(buffer, 2 + 2 * TEMPSENSOR_COUNT);
+}
+
+void cmdRescanSensors(uint32_t qdata)
+{
+    uint8_t mode = (qdata >> 8) & 0xFF;
+    bool    ok   = (mode <= 1) && (tempSensors.busCount() > 0);    // NTC sensors have no ROM codes
+    if (ok) {
+        ds18RescanKeep = (mode == 0);
+        ds18Rescan     = (1 << tempSensors.busCount()) - 1;    // done by taskSensors()
+    }
+    buffer[0] = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdGetFanRpm(uint32_t qdata)
+{
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = FAN_COUNT;
+    for (uint8_t i = 0; i < FAN_COUNT; i++) {
+        uint16_t rpm      = getRpm(i);
+        buffer[2 + i * 2] = rpm >> 8;
+        buffer[3 + i * 2] = rpm & 0xFF;
+    }
+    amCom.send(buffer, 2 + 2 * FAN_COUNT);
+}
+
+void cmdGetAll(uint32_t qdata)
+{
+    amCom.send(buffer, buildSnapshot(qdata & 0xFF));
+}
+
+void cmdGetStatus(uint32_t qdata)
+{
+    uint8_t absent = 0;
+    for (uint8_t i = 0; i < TEMPSENSOR_COUNT; i++) {
+        if ((tempSensors.ds18Mask & (1 << i)) && !ds18SensorPresent[i]) {
+            absent |= 1 << i;
         }
-        case AMAC_CMD::CmdEEReadByte: {
-            uint16_t eeAddr = (qdata >> 8) & 0xFFFF;
-            buffer[0]       = cmd;
-            buffer[1]       = 1;
-            buffer[2]       = EEPROM.read(eeAddr);
-            amCom.send(buffer, 3);
-            break;
+    }
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = alarm;
+    buffer[2] = fanctrl.stallMask();
+    buffer[3] = absent;
+    amCom.send(buffer, 4);
+}
+
+void cmdSetStream(uint32_t qdata)
+{
+    streamKeepAlive    = (qdata >> 8) & 0xFF;
+    streamTempDeadband = (qdata >> 16) & 0xFF;
+    streamRpmDeadband  = (qdata >> 24) & 0xFF;
+    streamTime         = millis() - streamKeepAlive * 1000UL;    // first frame with the next sample
+    buffer[0]          = qdata & 0xFF;    // ok code
+    amCom.send(buffer, 1);
+}
+
+void cmdGetFanPwm(uint32_t qdata)
+{
+    uint8_t channel = (qdata >> 8) & 0xFF;
+    buffer[0]       = qdata & 0xFF;
+    buffer[1]       = channel;
+    buffer[2]       = fanctrl.getPwm(channel);
+    amCom.send(buffer, 3);
+}
+
+void cmdSetFanPwm(uint32_t qdata)
+{
+    uint8_t channel = (qdata >> 8) & 0xFF;
+    uint8_t pwm     = (qdata >> 16) & 0xFF;
+    if ((channel < FAN_COUNT) && !fanCurve[channel].autonomous() && fanctrl.setPwm(channel, pwm)) {
+        buffer[0] = qdata & 0xFF;    // ok code
+    } else {
+        buffer[0] = 0xFF;    // error code
+    }
+    amCom.send(buffer, 1);
+}
+
+void cmdSetFanRpm(uint32_t qdata)
+{
+    uint8_t  channel = (qdata >> 8) & 0xFF;
+    uint16_t rpm     = (((qdata >> 16) & 0xFF) << 8) | ((qdata >> 24) & 0xFF);
+    bool     ok      = (channel < FAN_COUNT) && !fanCurve[channel].autonomous() && fanctrl.setTargetRpm(channel, rpm);
+    buffer[0]        = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdGetFanRpmCtrl(uint32_t qdata)
+{
+    uint8_t  channel = (qdata >> 8) & 0xFF;
+    uint16_t target  = fanctrl.getTargetRpm(channel);
+    int16_t  error   = fanctrl.getRpmError(channel);
+    buffer[0]        = qdata & 0xFF;
+    buffer[1]        = channel;
+    buffer[2]        = target >> 8;
+    buffer[3]        = target & 0xFF;
+    buffer[4]        = error >> 8;
+    buffer[5]        = error & 0xFF;
+    buffer[6]        = fanctrl.getPwm(channel);
+    amCom.send(buffer, 7);
+}
+
+void cmdSetPidGain(uint32_t qdata)
+{
+    uint8_t  channel = (qdata >> 8) & 0x0F;
+    uint8_t  gain    = (qdata >> 12) & 0x0F;
+    uint16_t value   = (((qdata >> 16) & 0xFF) << 8) | ((qdata >> 24) & 0xFF);
+    bool     ok      = fanctrl.setGain(channel, gain, value);
+    if (ok) {
+        fanGainDirty |= 1 << channel;    // stored in the background, see taskEEPROM()
+    }
+    buffer[0] = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdEEReadByte(uint32_t qdata)
+{
+    uint16_t eeAddr = (qdata >> 8) & 0xFFFF;
+    buffer[0]       = qdata & 0xFF;
+    buffer[1]       = 1;
+    buffer[2]       = EEPROM.read(eeAddr);
+    amCom.send(buffer, 3);
+}
+
+void cmdEEWriteByte(uint32_t qdata)
+{
+    uint16_t eeAddr = (qdata >> 8) & 0xFFFF;
+    uint8_t  value  = (qdata >> 24) & 0xFF;
+    bool     ok     = eeWriter.start(eeAddr, &value, 1);    // written in the background, see eepromWritten()
+    eeWriteHost     = eeWriteHost || ok;
+    buffer[0]       = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdEEReadBlock(uint32_t qdata)
+{
+    uint16_t eeAddr = (qdata >> 8) & 0xFFFF;
+    uint8_t  count  = (qdata >> 24) & 0xFF;
+    if ((count == 0) || (count > AMCOM_BLOCK_SIZE) || ((uint32_t)eeAddr + count > EEPROM.length())) {
+        buffer[0] = 0xFF;    // error code
+        amCom.send(buffer, 1);
+        return;
+    }
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = eeAddr & 0xFF;    // address bytes in the order received
+    buffer[2] = eeAddr >> 8;
+    buffer[3] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        buffer[4 + i] = EEPROM.read(eeAddr + i);
+    }
+    buffer[4 + count] = EEWRITER::crc8(&buffer[4], count);
+    amCom.send(buffer, 5 + count);
+}
+
+void cmdEEWriteBlock(uint32_t qdata)
+{
+    uint16_t       eeAddr = (qdata >> 8) & 0xFFFF;
+    uint8_t        count  = (qdata >> 24) & 0xFF;
+    const uint8_t* data   = amCom.blockData();
+    bool           ok     = (count > 0) && (EEWRITER::crc8(data, count) == data[count]) && eeWriter.start(eeAddr, data, count);
+    if (count > 0) {
+        amCom.blockRelease();
+    }
+    eeWriteHost = eeWriteHost || ok;
+    buffer[0]   = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdEEWriteStatus(uint32_t qdata)
+{
+    buffer[0] = qdata & 0xFF;
+    buffer[1] = eeWriter.status();
+    buffer[2] = eeWriter.address() & 0xFF;    // address bytes in the order of EEWriteBlock
+    buffer[3] = eeWriter.address() >> 8;
+    buffer[4] = eeWriter.count();
+    amCom.send(buffer, 5);
+}
+
+void cmdGetHistory(uint32_t qdata)
+{
+    uint8_t channel = (qdata >> 8) & 0xFF;
+    uint8_t seq     = (qdata >> 16) & 0xFF;
+    bool    reset   = ((qdata >> 24) & 0xFF) == 1;
+    if (channel >= HISTORY_CHANNELS) {
+        buffer[0] = 0xFF;    // error code
+        amCom.send(buffer, 1);
+        return;
+    }
+    uint8_t samples;
+    uint8_t len = history.encode(channel, seq, samples, &buffer[10], sizeof(buffer) - 10);
+    buffer[0]   = qdata & 0xFF;
+    buffer[1]   = channel;
+    buffer[2]   = seq;
+    buffer[3]   = samples;
+    buffer[4]   = history.minimum(channel) >> 8;
+    buffer[5]   = history.minimum(channel) & 0xFF;
+    buffer[6]   = history.maximum(channel) >> 8;
+    buffer[7]   = history.maximum(channel) & 0xFF;
+    buffer[8]   = history.average(channel) >> 8;
+    buffer[9]   = history.average(channel) & 0xFF;
+    amCom.send(buffer, 10 + len);
+    if (reset) {
+        history.resetStats();
+    }
+}
+
+// the fan curve of a secondary channel of a shared pwm output would fight with the primary channel, host mode only
+void cmdSetFanMode(uint32_t qdata)
+{
+    uint8_t channel = (qdata >> 8) & 0xFF;
+    uint8_t mode    = (qdata >> 16) & 0xFF;
+    bool    ok      = (channel < FAN_COUNT) && ((mode == FANCURVE_MODE_HOST) || fanctrl.primary(channel)) && fanCurve[channel].setMode(mode);
+    if (ok) {
+        fanCurveDirty |= 1 << channel;    // stored in the background, see taskEEPROM()
+    }
+    buffer[0] = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdSetCurveParam(uint32_t qdata)
+{
+    uint8_t channel = (qdata >> 8) & 0xFF;
+    uint8_t param   = (qdata >> 16) & 0xFF;
+    uint8_t value   = (qdata >> 24) & 0xFF;
+    bool    ok      = (channel < FAN_COUNT) && fanCurve[channel].setParam(param, value);
+    if (ok) {
+        fanCurveDirty |= 1 << channel;
+    }
+    buffer[0] = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+void cmdSetCurvePoint(uint32_t qdata)
+{
+    uint8_t channel     = (qdata >> 8) & 0x0F;
+    uint8_t point       = (qdata >> 12) & 0x0F;
+    int8_t  temperature = (qdata >> 16) & 0xFF;    // C
+    uint8_t pwm         = (qdata >> 24) & 0xFF;
+    bool    ok          = (channel < FAN_COUNT) && fanCurve[channel].setPoint(point, temperature * 10, pwm);
+    if (ok) {
+        fanCurveDirty |= 1 << channel;
+    }
+    buffer[0] = ok ? (qdata & 0xFF) : 0xFF;    // ok / error code
+    amCom.send(buffer, 1);
+}
+
+typedef void (*CommandHandler)(uint32_t qdata);
+
+void cmdGetStats(uint32_t qdata);    // needs the command table, see below
+
+struct CommandEntry {
+    uint8_t        cmd;
+    CommandHandler handler;
+};
+
+const CommandEntry commandTable[] PROGMEM = {
+    { AMAC_CMD::CmdGetCaps, cmdGetCaps },
+    { AMAC_CMD::CmdGetTemp, cmdGetTemp },
+    { AMAC_CMD::CmdRescanSensors, cmdRescanSensors },
+    { AMAC_CMD::CmdGetFanRpm, cmdGetFanRpm },
+    { AMAC_CMD::CmdGetFanPwm, cmdGetFanPwm },
+    { AMAC_CMD::CmdSetFanPwm, cmdSetFanPwm },
+    { AMAC_CMD::CmdSetFanRpm, cmdSetFanRpm },
+    { AMAC_CMD::CmdGetFanRpmCtrl, cmdGetFanRpmCtrl },
+    { AMAC_CMD::CmdSetPidGain, cmdSetPidGain },
+    { AMAC_CMD::CmdEEReadByte, cmdEEReadByte },
+    { AMAC_CMD::CmdEEWriteByte, cmdEEWriteByte },
+    { AMAC_CMD::CmdEEReadBlock, cmdEEReadBlock },
+    { AMAC_CMD::CmdEEWriteBlock, cmdEEWriteBlock },
+    { AMAC_CMD::CmdEEWriteStatus, cmdEEWriteStatus },
+    { AMAC_CMD::CmdGetAll, cmdGetAll },
+    { AMAC_CMD::CmdSetStream, cmdSetStream },
+    { AMAC_CMD::CmdGetStatus, cmdGetStatus },
+    { AMAC_CMD::CmdGetStats, cmdGetStats },
+    { AMAC_CMD::CmdGetHistory, cmdGetHistory },
+    { AMAC_CMD::CmdSetFanMode, cmdSetFanMode },
+    { AMAC_CMD::CmdSetCurveParam, cmdSetCurveParam },
+    { AMAC_CMD::CmdSetCurvePoint, cmdSetCurvePoint },
+};
+#define COMMAND_COUNT (sizeof(commandTable) / sizeof(commandTable[0]))
+
+PERFSTAT commandStat[COMMAND_COUNT];    // service latency of each command, message received to answer queued
+PERFSTAT latencyStat;                   // service latency of all commands
+
+void cmdGetStats(uint32_t qdata)
+{
+    bool            reset = ((qdata >> 8) & 0xFF) == 1;
+    uint8_t         cmd   = (qdata >> 16) & 0xFF;
+    const PERFSTAT* stat  = &latencyStat;
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+        if ((cmd != 0) && (pgm_read_byte(&commandTable[i].cmd) == cmd)) {
+            stat = &commandStat[i];
         }
-        case AMAC_CMD::CmdEEWriteByte: {
-            uint16_t eeAddr = (qdata >> 8) & 0xFFFF;
-            uint8_t  value  = (qdata >> 24) & 0xFF;
-            if (value != EEPROM.read(eeAddr)) {
-                EEPROM.write(eeAddr, value);
-                delay(20);    // wait for EE value to be written
-            }
-            buffer[0] = cmd;    // ok code (if needed, do an additional verify here)
-            amCom.send(buffer, 1);
-            break;
+    }
+    const AMCOMSTATS& link      = amCom.stats();
+    unsigned long     sampleAge = millis() - lastSampleTime;
+    sampleAge                   = min(sampleAge, 0xFFFFUL);    // ms
+    buffer[0]                   = qdata & 0xFF;
+    buffer[1]                   = link.rxFrames >> 8;
+    buffer[2]                   = link.rxFrames & 0xFF;
+    buffer[3]                   = link.crcErrors >> 8;
+    buffer[4]                   = link.crcErrors & 0xFF;
+    buffer[5]                   = link.parserResets >> 8;
+    buffer[6]                   = link.parserResets & 0xFF;
+    buffer[7]                   = link.txFrames >> 8;
+    buffer[8]                   = link.txFrames & 0xFF;
+    buffer[9]                   = link.queueHigh;
+    buffer[10]                  = link.queueDrops;
+    buffer[11]                  = loopStat.average() >> 8;
+    buffer[12]                  = loopStat.average() & 0xFF;
+    buffer[13]                  = loopStat.maximum() >> 8;
+    buffer[14]                  = loopStat.maximum() & 0xFF;
+    buffer[15]                  = cmd;
+    buffer[16]                  = stat->average() >> 8;
+    buffer[17]                  = stat->average() & 0xFF;
+    buffer[18]                  = stat->maximum() >> 8;
+    buffer[19]                  = stat->maximum() & 0xFF;
+    buffer[20]                  = sampleAge >> 8;
+    buffer[21]                  = sampleAge & 0xFF;
+    buffer[22]                  = scheduler.idle();
+    amCom.send(buffer, 23);
+
+    if (reset) {
+        amCom.resetStats();
+        loopStat.reset();
+        latencyStat.reset();
+        for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+            commandStat[i].reset();
         }
-        default:
+    }
+}
+
+//---------------------------------------------------------
+void processCommands()
+{
+    // process all queued commands, as long as the answers fit into the transmit queue
+    while ((amCom.queueCount() > 0) && amCom.sendReady()) {
+        // EEWriteByte waits in the queue until the background writer is free, later commands wait behind it
+        if ((amCom.queueNext() == AMAC_CMD::CmdEEWriteByte) && eeWriter.busy()) {
             break;
         }
+        unsigned long timeReceived;
+        uint32_t      qdata = amCom.queuePop(timeReceived);
+        uint8_t       cmd   = qdata & 0xFF;
+        for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+            if (pgm_read_byte(&commandTable[i].cmd) == cmd) {
+                ((CommandHandler)pgm_read_ptr(&commandTable[i].handler))(qdata);
+                unsigned long latency = micros() - timeReceived;
+                commandStat[i].add(latency);
+                latencyStat.add(latency);
+                break;
+            }
+        }
     }
 }
@@ -12,9 +12,34 @@
 
 #ifndef _AMCOM_H_
 
-#include "queue.h"
+#include "ringbuffer.h"
 #include <util/crc16.h>
 
+#define AMCOM_QUEUE_SIZE 16         // command queue size, must be a power of two
+#define AMCOM_TXQUEUE_SIZE 128      // transmit queue size in bytes, must be a power of two, several answers
+#define AMCOM_BAUD_DEFAULT 57600    // baud rate after reset and after a baud rate fallback
+#define AMCOM_BAUD_TIMEOUT 3000     // ms after SetBaud without a valid message at the new baud rate until it falls back to the default
+#define AMCOM_BAUD_IDLE 10000       // ms without a valid message at a confirmed baud rate until it falls back to the default
+#define AMCOM_TX_RESERVE 8          // transmit queue bytes kept free for the answer sent by the parser, addressed ProbeDevice
+#define AMCOM_BLOCK_SIZE 32         // max. data bytes of EEReadBlock and EEWriteBlock messages
+#define AMCOM_TURNAROUND_US 500     // us between the end of an addressed message and the answer, releases a half-duplex bus
+#define AMCOM_SLOT_TIME_US 4000     // us answer slot per bus address for broadcast ProbeDevice messages
+#define AMCOM_ADDR_BROADCAST 0      // bus address of broadcast messages
+
+// message flags
+#define AMCOM_ADDRESSED 0x01    // addressed message (0xAB), answered with an addressed message (0xC6)
+#define AMCOM_BROADCAST 0x02    // addressed to all devices, only ProbeDevice is answered
+
+// link counters, the counters wrap around
+struct AMCOMSTATS {
+    uint16_t rxFrames;        // valid messages
+    uint16_t crcErrors;       // messages with a bad crc
+    uint16_t parserResets;    // incomplete messages dropped after the 250ms timeout
+    uint16_t txFrames;        // messages queued for transmission
+    uint8_t  queueHigh;       // command queue high-water mark
+    uint8_t  queueDrops;      // commands dropped on a full command queue
+};
+
 template <uint8_t DEVID, uint8_t TEMPCNT, uint8_t FANCNT> class AMCOM {
 
 public:
@@ -22,137 +47,423 @@ public:
         : timeStartMsg(0)
         , receiveState(0)
         , receiveLength(0)
-        , queue(10)
+        , receiveCount(0)
+        , receiveCrc(0)
+        , sendRemaining(0)
+        , timeLastMsg(0)
+        , msgReceived(false)
+        , baudRate(AMCOM_BAUD_DEFAULT)
+        , baudRatePending(0)
+        , baudConfirm(false)
+        , blockLength(0)
+        , busAddress(DEVID)
+        , receiveFlags(0)
+        , replyFlags(0)
+        , busMessage(false)
+        , timeHoldOff(0)
+        , holdOff(0)
     {
         memset(rawBuffer, 0, sizeof(rawBuffer));
         memset(receiveBuffer, 0, sizeof(receiveBuffer));
+        memset(blockBuffer, 0, sizeof(blockBuffer));
+        resetStats();
+    }
+
+    void begin()
+    {
+        baudRate    = AMCOM_BAUD_DEFAULT;
+        baudConfirm = false;
+        Serial.begin(baudRate);
+#ifdef PIN_RS485_DE
+        pinMode(PIN_RS485_DE, OUTPUT);
+        digitalWrite(PIN_RS485_DE, LOW);    // receive
+#endif
     }
 
-    void delay(unsigned long delay_ms)
+    // device id and bus address 1..254, reported by ProbeDevice
+    void setAddress(uint8_t address) { busAddress = ((address != AMCOM_ADDR_BROADCAST) && (address != 0xFF)) ? address : DEVID; }
+
+    uint8_t address() { return busAddress; }
+
+    // the last valid message was addressed, the device shares a bus and must not send unsolicited messages
+    bool busMode() { return busMessage; }
+
+    // process received bytes and transmit queued messages without waiting
+    void service()
     {
-        unsigned long timeStamp = millis();
-        while ((millis() - timeStamp) < delay_ms) {
-            receive();
+        receive();
+        transmit();
+#ifdef PIN_RS485_DE
+        // release the bus when the last stop bit is sent, TXC0 is cleared with every written byte
+        if ((sendRemaining == 0) && (txQueue.count() == 0) && (UCSR0A & (1 << TXC0))) {
+            digitalWrite(PIN_RS485_DE, LOW);
+        }
+#endif
+
+        // without a valid message after a baud rate switch, the host did not follow: fall back so ProbeDevice works again
+        // once confirmed, a restarted host probes at the default baud rate, so the fallback stays armed with a longer timeout
+        if ((baudRate != AMCOM_BAUD_DEFAULT) && ((millis() - timeLastMsg) > (baudConfirm ? AMCOM_BAUD_IDLE : AMCOM_BAUD_TIMEOUT))) {
+            dbgPrintln("baud rate fallback");
+            begin();
         }
     }
 
+    // queue a message for transmission, never blocks and never calls receive()
+    // answers to addressed messages are addressed, answers to broadcast messages are dropped
     bool send(uint8_t* buffer, uint8_t length)
     {
+        uint8_t flags = replyFlags;
+        replyFlags    = 0;
+        if (flags & AMCOM_BROADCAST) {
+            return true;
+        }
+        uint8_t header = (flags & AMCOM_ADDRESSED) ? 4 : 3;
         if (length > (sizeof(rawBuffer) - 6)) {
             return false;
         }
-        uint8_t len      = 0;
-        rawBuffer[len++] = 0xC5;
-        rawBuffer[len++] = length + 1;    // bytes to come including crc
+        if ((uint8_t)(length + header) > txQueue.space()) {
+            return false;
+        }
+        uint8_t len = 0;
+        if (flags & AMCOM_ADDRESSED) {
+            rawBuffer[len++] = 0xC6;
+            rawBuffer[len++] = length + 2;    // bytes to come including address and crc
+            rawBuffer[len++] = busAddress;
+        } else {
+            rawBuffer[len++] = 0xC5;
+            rawBuffer[len++] = length + 1;    // bytes to come including crc
+        }
         for (uint8_t i = 0; i < length; i++) {
             rawBuffer[len++] = buffer[i];
         }
         uint8_t crc8     = _crc8(rawBuffer, len);
         rawBuffer[len++] = crc8;
         for (uint8_t i = 0; i < len; i++) {
-            Serial.write(rawBuffer[i]);
+            txQueue.push(rawBuffer[i]);
         }
-        delay(50);    // decouple consecutive send messages
         memset(rawBuffer, 0, sizeof(rawBuffer));
+        linkStats.txFrames++;
         return true;
     }
 
-    int queueCount() { return queue.count(); }
+    // true if the transmit queue can take a message of maximum length
+    // and still has room for a ProbeDevice or SetBaud answer, which is queued at once by the parser
+    bool sendReady() { return txQueue.space() >= sizeof(rawBuffer) + AMCOM_TX_RESERVE; }
 
-    uint32_t queuePop() { return queue.pop(); }
+    uint8_t queueCount() { return queue.count(); }
+
+    // cmd of the next queued command, without removing it
+    uint8_t queueNext() { return queue.peek().data & 0xFF; }
+
+    // timeReceived: micros() time stamp of the message, for the service latency
+    // the next send() is the answer to this command
+    uint32_t queuePop(unsigned long& timeReceived)
+    {
+        QueueEntry entry = queue.pop();
+        timeReceived     = entry.timeReceived;
+        replyFlags       = entry.flags;
+        return entry.data;
+    }
+
+    const AMCOMSTATS& stats() { return linkStats; }
+
+    // data of the queued CmdEEWriteBlock followed by its payload crc, free it with blockRelease() after processing
+    const uint8_t* blockData() { return blockBuffer; }
+
+    void blockRelease() { blockLength = 0; }
+
+    void resetStats() { memset(&linkStats, 0, sizeof(linkStats)); }
+
+    // a host has sent valid messages, but none for timeout_ms
+    bool linkTimeout(unsigned long timeout_ms) { return msgReceived && ((millis() - timeLastMsg) > timeout_ms); }
 
 private:
-    unsigned long   timeStartMsg;
-    uint8_t         rawBuffer[32];
-    uint8_t         receiveBuffer[20];
-    uint8_t         receiveState;
-    uint8_t         receiveLength;
-    uint8_t*        receivePtr;
-    Queue<uint32_t> queue;
+    struct QueueEntry {
+        uint32_t      data;            // cmd and parameters
+        unsigned long timeReceived;    // us time stamp
+        uint8_t       flags;           // AMCOM_ADDRESSED, AMCOM_BROADCAST
+    };
+
+    unsigned long                            timeStartMsg;
+    uint8_t                                  rawBuffer[48];
+    uint8_t                                  receiveBuffer[AMCOM_BLOCK_SIZE + 8];
+    uint8_t                                  receiveState;
+    uint8_t                                  receiveLength;
+    uint8_t                                  receiveCount;
+    uint8_t                                  receiveCrc;
+    RingBuffer<QueueEntry, AMCOM_QUEUE_SIZE> queue;
+    RingBuffer<uint8_t, AMCOM_TXQUEUE_SIZE>  txQueue;
+    static_assert(AMCOM_TXQUEUE_SIZE >= sizeof(rawBuffer) + AMCOM_TX_RESERVE, "transmit queue too small");
+    uint8_t                                  sendRemaining;
+    unsigned long                            timeLastMsg;
+    bool                                     msgReceived;
+    uint32_t                                 baudRate;
+    uint32_t                                 baudRatePending;
+    bool                                     baudConfirm;    // valid message at the current baud rate
+    AMCOMSTATS                               linkStats;
+    uint8_t                                  blockBuffer[AMCOM_BLOCK_SIZE + 1];
+    uint8_t                                  blockLength;    // 0 = free
+    uint8_t                                  busAddress;
+    uint8_t                                  receiveFlags;    // flags of the message being decoded
+    uint8_t                                  replyFlags;      // flags of the message the next send() answers
+    bool                                     busMessage;
+    unsigned long                            timeHoldOff;    // us, end of the last addressed message
+    unsigned long                            holdOff;        // us, bus turnaround and answer slot after timeHoldOff
+
+    // write queued messages to the serial port as far as its transmit buffer allows
+    // messages follow each other without a gap, only answers to addressed messages wait for the bus turnaround
+    void transmit()
+    {
+        if (sendRemaining == 0) {
+            if ((txQueue.count() == 0) || ((micros() - timeHoldOff) < holdOff)) {
+                return;
+            }
+            sendRemaining = txQueue.peek(1) + 2;    // 0xC5/0xC6, byteCnt, bytes to come
+#ifdef PIN_RS485_DE
+            digitalWrite(PIN_RS485_DE, HIGH);    // transmit
+#endif
+        }
+        while ((sendRemaining > 0) && (Serial.availableForWrite() > 0)) {
+            Serial.write(txQueue.pop());
+            sendRemaining--;
+        }
+        if (sendRemaining == 0) {
+            // switch the baud rate after its acknowledge is sent completely
+            if ((baudRatePending != 0) && (txQueue.count() == 0)) {
+                Serial.flush();
+                baudRate        = baudRatePending;
+                baudRatePending = 0;
+                baudConfirm     = false;
+                timeLastMsg     = millis();
+                Serial.begin(baudRate);
+            }
+        }
+    }
+
+    // baud rate codes of CmdSetBaud, 0 = invalid code
+    uint32_t baudRateFromCode(uint8_t code)
+    {
+        switch (code) {
+        case 0:
+            return 57600;
+        case 1:
+            return 115200;
+        case 2:
+            return 250000;
+        case 3:
+            return 500000;
+        case 4:
+            return 1000000;
+        default:
+            return 0;
+        }
+    }
 
     void receive()
     {
         while (Serial.available()) {
-            int data = Serial.read();
-
-            switch (receiveState) {
-            case 0:
-                if (data == 0xAA) {
-                    memset(receiveBuffer, 0, sizeof(receiveBuffer));
-                    receivePtr    = receiveBuffer;
-                    *receivePtr++ = data;
-                    receiveState  = 1;
-                    timeStartMsg  = millis();
-                }
-                break;
-            case 1:
-                if ((data >= 2) && (data <= 5)) {    // known commands have 2..5 bytes length codes
-                    *receivePtr++ = data;
-                    receiveLength = data;
-                    receiveState  = 2;
-                } else {
+            if (!parse(Serial.read())) {
+                resync();
+            }
+        }
+
+        // drop incomplete messages with a 250msec timeout, a complete message may follow the start byte
+        if ((receiveState != 0) && ((millis() - timeStartMsg) > 250)) {
+            linkStats.parserResets++;
+            dbgPrintln("receiveState reset");
+            resync();
+        }
+    }
+
+    // rescan the buffered bytes of a dropped message after its start byte instead of discarding them
+    // a message dropped during the rescan is moved in front of the unread bytes and rescanned from its second byte
+    void resync()
+    {
+        uint8_t count = receiveCount;
+        uint8_t pos   = 1;
+        receiveState  = 0;
+        receiveCount  = 0;
+        while (pos < count) {
+            // the parser writes at most up to index pos - 2, unread bytes are not overwritten
+            if (!parse(receiveBuffer[pos++])) {
+                uint8_t dropped = receiveCount;
+                memmove(&receiveBuffer[dropped], &receiveBuffer[pos], count - pos);
+                count        = dropped + count - pos;
+                pos          = 1;
+                receiveState = 0;
+                receiveCount = 0;
+            }
+        }
+    }
+
+    // streaming message parser, crc8 is updated with every byte
+    // false: bad length byte or crc, the message is dropped, its bytes stay in receiveBuffer for resync()
+    bool parse(uint8_t data)
+    {
+        switch (receiveState) {
+        case 0:
+            if ((data == 0xAA) || (data == 0xAB)) {    // plain or addressed message
+                receiveBuffer[0] = data;
+                receiveCount     = 1;
+                receiveCrc       = _crc_ibutton_update(0, data);
+                receiveState     = 1;
+                timeStartMsg     = millis();
+            }
+            break;
+        case 1:
+            receiveBuffer[receiveCount++] = data;
+            // 2..5 bytes length codes, up to AMCOM_BLOCK_SIZE + 5 for EEWriteBlock, one more for the address of addressed messages
+            if ((data >= 2) && (data <= AMCOM_BLOCK_SIZE + ((receiveBuffer[0] == 0xAB) ? 6 : 5))) {
+                receiveCrc    = _crc_ibutton_update(receiveCrc, data);
+                receiveLength = data;
+                receiveState  = 2;
+            } else {
+                return false;
+            }
+            break;
+        case 2:
+            receiveBuffer[receiveCount++] = data;
+            receiveLength--;
+            if (receiveLength > 0) {
+                receiveCrc = _crc_ibutton_update(receiveCrc, data);
+            } else {
+                uint32_t qc;
+                if (receiveCrc == data) {
                     receiveState = 0;
-                }
-                break;
-            case 2:
-                *receivePtr++ = data;
-                receiveLength--;
-                if (receiveLength == 0) {
-                    uint8_t  len  = receiveBuffer[1] + 1;    // all message bytes without crc8 byte
-                    uint8_t  crc8 = _crc8(receiveBuffer, len);
-                    uint32_t qc;
-                    if (crc8 == data) {
-                        uint8_t cmd = receiveBuffer[2];
-                        switch (cmd) {
-                        case CmdProbeDevice:    // answer CmdProbeDevice at once (200msec timeout in Argus Monitor on Argus Controller init)
-                            uint8_t b[4];
-                            b[0] = cmd;
-                            b[1] = DEVID;
-                            b[2] = TEMPCNT;
-                            b[3] = FANCNT;
-                            send(b, 4);
-                            break;
-                        case CmdGetTemp:
-                        case CmdGetFanRpm:
-                            queue.push((uint32_t)cmd);
-                            break;
-                        case CmdGetFanPwm:
-                            // cmd, channel
-                            qc = cmd | (((uint32_t)receiveBuffer[3]) << 8);
-                            queue.push(qc);
-                            break;
-                        case CmdSetFanPwm:
-                        case CmdEEReadByte:
-                            // CmdSetFanPwm:  cmd, channel, pwm value
-                            // CmdEEReadByte: cmd, addrH, addrL
-                            qc = cmd | (((uint32_t)receiveBuffer[3]) << 8) | (((uint32_t)receiveBuffer[4]) << 16);
-                            queue.push(qc);
-                            break;
-                        case CmdEEWriteByte:
-                            // cmd, addrH, addrL, value
-                            qc = cmd | (((uint32_t)receiveBuffer[3]) << 8) | (((uint32_t)receiveBuffer[4]) << 16)
-                                 | (((uint32_t)receiveBuffer[5]) << 24);
-                            queue.push(qc);
-                            break;
-                        default:
-                            break;
+                    receiveFlags = 0;
+                    if (receiveBuffer[0] == 0xAB) {
+                        uint8_t address = receiveBuffer[2];
+                        if ((address != busAddress) && (address != AMCOM_ADDR_BROADCAST)) {
+                            receiveCount = 0;
+                            break;    // message for another device
                         }
+                        receiveFlags = AMCOM_ADDRESSED | ((address == AMCOM_ADDR_BROADCAST) ? AMCOM_BROADCAST : 0);
+                        timeHoldOff  = micros();
+                        holdOff      = AMCOM_TURNAROUND_US + ((address == AMCOM_ADDR_BROADCAST) ? busAddress * (unsigned long)AMCOM_SLOT_TIME_US : 0);
+
+                        // remove the address, the message is decoded like a plain one
+                        receiveBuffer[1]--;
+                        memmove(&receiveBuffer[2], &receiveBuffer[3], receiveCount - 3);
                     } else {
-                        dbgPrintln("CRC Error");
+                        holdOff = 0;
                     }
-                    receiveState = 0;
+                    busMessage   = (receiveFlags != 0);
+                    receiveCount = 0;
+                    timeLastMsg  = millis();
+                    msgReceived  = true;
+                    baudConfirm  = true;
+                    linkStats.rxFrames++;
+                    uint8_t cmd  = receiveBuffer[2];
+                    uint8_t b[4];
+                    switch (cmd) {
+                    case CmdProbeDevice:    // answer CmdProbeDevice at once (200msec timeout in Argus Monitor on Argus Controller init)
+                        replyFlags = receiveFlags & AMCOM_ADDRESSED;    // broadcast probes are answered in the slot of the bus address
+                        b[0]       = cmd;
+                        b[1]       = busAddress;
+                        b[2]       = TEMPCNT;
+                        b[3]       = FANCNT;
+                        send(b, 4);
+                        break;
+                    case CmdSetBaud:    // answered at once with the current baud rate, switched after the answer is sent
+                        if (receiveFlags & AMCOM_BROADCAST) {
+                            break;    // needs an answer, not for broadcasts
+                        }
+                        replyFlags      = receiveFlags;
+                        baudRatePending = baudRateFromCode(receiveBuffer[3]);
+                        b[0]            = (baudRatePending != 0) ? cmd : (uint8_t)CmdError;
+                        send(b, 1);
+                        break;
+                    case CmdGetCaps:
+                    case CmdGetTemp:
+                    case CmdGetFanRpm:
+                    case CmdGetAll:
+                    case CmdGetStatus:
+                    case CmdEEWriteStatus:
+                        queuePush((uint32_t)cmd);
+                        break;
+                    case CmdGetFanPwm:
+                    case CmdGetFanRpmCtrl:
+                    case CmdRescanSensors:
+                        // cmd, channel (CmdRescanSensors: mode)
+                        qc = cmd | (((uint32_t)receiveBuffer[3]) << 8);
+                        queuePush(qc);
+                        break;
+                    case CmdSetFanPwm:
+                    case CmdEEReadByte:
+                    case CmdSetFanMode:
+                    case CmdGetStats:
+                        // CmdSetFanPwm:  cmd, channel, pwm value
+                        // CmdEEReadByte: cmd, addrH, addrL
+                        // CmdSetFanMode: cmd, channel, mode
+                        // CmdGetStats:   cmd, reset, latency cmd
+                        qc = cmd | (((uint32_t)receiveBuffer[3]) << 8) | (((uint32_t)receiveBuffer[4]) << 16);
+                        queuePush(qc);
+                        break;
+                    case CmdEEWriteByte:
+                    case CmdSetStream:
+                    case CmdSetCurveParam:
+                    case CmdSetCurvePoint:
+                    case CmdSetFanRpm:
+                    case CmdSetPidGain:
+                    case CmdEEReadBlock:
+                    case CmdGetHistory:
+                        // CmdEEWriteByte:   cmd, addrH, addrL, value
+                        // CmdSetStream:     cmd, keep alive, temperature deadband, rpm deadband
+                        // CmdSetCurveParam: cmd, channel, param, value
+                        // CmdSetCurvePoint: cmd, point|channel, temperature, pwm value
+                        // CmdSetFanRpm:     cmd, channel, rpmH, rpmL
+                        // CmdSetPidGain:    cmd, gain|channel, valueH, valueL
+                        // CmdEEReadBlock:   cmd, addrH, addrL, count
+                        // CmdGetHistory:    cmd, channel, seq, reset
+                        qc = cmd | (((uint32_t)receiveBuffer[3]) << 8) | (((uint32_t)receiveBuffer[4]) << 16)
+                             | (((uint32_t)receiveBuffer[5]) << 24);
+                        queuePush(qc);
+                        break;
+                    case CmdEEWriteBlock:
+                        // cmd, addrH, addrL, count, data and payload crc in blockBuffer
+                        // count 0: no data, the previous block is still queued or the length is invalid
+                        qc = cmd | (((uint32_t)receiveBuffer[3]) << 8) | (((uint32_t)receiveBuffer[4]) << 16);
+                        if ((blockLength == 0) && (receiveBuffer[1] >= 6) && (receiveBuffer[1] <= AMCOM_BLOCK_SIZE + 5)) {
+                            blockLength = receiveBuffer[1] - 5;    // without cmd, addrH, addrL, payload crc, crc
+                            memcpy(blockBuffer, &receiveBuffer[5], blockLength + 1);
+                            qc |= ((uint32_t)blockLength) << 24;
+                        }
+                        if (!queuePush(qc) && (qc >> 24)) {
+                            blockRelease();    // dropped
+                        }
+                        break;
+                    default:
+                        break;
+                    }
+                } else {
+                    linkStats.crcErrors++;
+                    dbgPrintln("CRC Error");
+                    return false;
                 }
-                break;
-            default:
-                break;
             }
+            break;
+        default:
+            receiveState = 0;
+            receiveCount = 0;
+            break;
         }
+        return true;
+    }
 
-        // reset message receive state machine on incomplete messages with a 250msec timeout
-        if ((receiveState != 0) && ((millis() - timeStartMsg) > 250)) {
-            receiveState = 0;
-            dbgPrintln("receiveState reset");
+    bool queuePush(uint32_t data)
+    {
+        QueueEntry entry;
+        entry.data         = data;
+        entry.timeReceived = micros();
+        entry.flags        = receiveFlags;
+        if (!queue.push(entry)) {
+            linkStats.queueDrops++;
+            return false;
         }
+        if (queue.count() > linkStats.queueHigh) {
+            linkStats.queueHigh = queue.count();
+        }
+        return true;
     }
 
     uint8_t _crc8(uint8_t* data, uint8_t len)
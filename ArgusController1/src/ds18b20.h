@@ -15,77 +15,267 @@
 
 #include <OneWire.h>
 
-#define TEMPERATURE_ERROR 0
+#define DS18B20_CONVERSION_TIME 750    // ms, max. conversion time at 12 bit resolution
+#define DS18B20_POLL_INTERVAL 10       // ms between conversion-complete polls on the bus
+#define DS18B20_ERRORS_MAX 3           // consecutive read errors until a sensor is treated as lost
+#define DS18B20_PROBE_TIME 1000        // ms until the first re-probe of a bus with a lost or missing sensor
+#define DS18B20_PROBE_BACKOFF 6        // the probe time doubles after every failed re-probe, up to 2^6 * 1s
 
-class DS18B20 {
+//---------------------------------------------------------
+// 1-wire bus on one pin, any number of DS18x20 sensors
+// all conversions are started at once with a Skip-ROM broadcast
+class DS18B20BUS {
 
 public:
-    DS18B20()
+    DS18B20BUS()
         : _oneWire(0)
-        , _temperature(TEMPERATURE_ERROR)
+        , _pin(0xFF)
+        , _deviceCount(0)
+        , _state(StateIdle)
+        , _samplePeriod(0)
+        , _conversionTime(DS18B20_CONVERSION_TIME)
+        , _timeStart(0)
+        , _timePoll(0)
+        , _probeTime(0)
+        , _probeBackoff(0)
     {
     }
 
-    bool init(uint8_t pin)
+    // (re)start without sensors, with a new conversion and a new search
+    void begin(uint8_t pin)
     {
-        bool rc = false;
-
-        memset(_addr, 0, sizeof(_addr));
+        _pin         = pin;
+        _deviceCount = 0;
+        _state       = StateIdle;
         _oneWire.begin(pin);
+        _oneWire.reset_search();
+    }
 
-        if (_oneWire.search(_addr) == 1) {
-            if (OneWire::crc8(_addr, 7) == _addr[7]) {
-                if (_addr[0] == 0x10 || _addr[0] == 0x28 || _addr[0] == 0x22) {
-                    rc = true;
-                    if (_addr[0] == 0x10) {
-                        dbgPrint(F("DS18S20 found: "));
-                    } else if (_addr[0] == 0x28) {
-                        dbgPrint(F("DS18B20 found: "));
-                    } else {
-                        dbgPrint(F(" DS1820 found: "));
-                    }
+    // new conversion and a new search, the attached sensors stay attached and keep their temperature
+    void restart()
+    {
+        _state = StateIdle;
+        _oneWire.reset_search();
+    }
+
+    uint8_t pin() { return _pin; }
+
+    // number of sensors attached to the bus, see DS18B20::attach()
+    uint8_t count() { return _deviceCount; }
+
+    ::OneWire& oneWire() { return _oneWire; }
+
+    // re-probe of missing sensors, the time since the last probe doubles with every failed probe (backoff)
+    void scheduleProbe(bool backoff)
+    {
+        _probeTime    = millis();
+        _probeBackoff = !backoff ? 0 : ((_probeBackoff < DS18B20_PROBE_BACKOFF) ? _probeBackoff + 1 : DS18B20_PROBE_BACKOFF);
+    }
+
+    bool probeDue() { return (millis() - _probeTime) >= ((unsigned long)DS18B20_PROBE_TIME << _probeBackoff); }
+
+    // ROM code of a DS18x20 device with a valid crc
+    static bool isSensor(const uint8_t* addr)
+    {
+        return ((addr[0] == 0x10) || (addr[0] == 0x28) || (addr[0] == 0x22)) && (OneWire::crc8(addr, 7) == addr[7]);
+    }
+
+    // find the next DS18x20 device on the bus, skips unknown devices
+    bool search(uint8_t* addr)
+    {
+        while (_oneWire.search(addr) == 1) {
+            if (isSensor(addr)) {
+                if (addr[0] == 0x10) {
+                    dbgPrint(F("DS18S20 found: "));
+                } else if (addr[0] == 0x28) {
+                    dbgPrint(F("DS18B20 found: "));
+                } else {
+                    dbgPrint(F(" DS1820 found: "));
+                }
+                printAddr(addr);
+                return true;
+            }
+            dbgPrint(F("Unknown Device: "));
+            printAddr(addr);
+        }
+        dbgPrintln(F("No more sensors"));
+        return false;
+    }
+
+    // sample period in ms from conversion start to the next conversion start
+    // 0 = start the next conversion as soon as the last one was read
+    void setSamplePeriod(uint16_t period) { _samplePeriod = period; }
+
+    // max. conversion time in ms of the slowest sensor on the bus, used for the conversion timeout
+    void setConversionTime(uint16_t time) { _conversionTime = time; }
+
+    // non-blocking conversion state machine, call as often as possible
+    // returns true if the conversion of all sensors on the bus is complete and the scratchpads can be read
+    bool update()
+    {
+        bool rc = false;
+
+        switch (_state) {
+        case StateIdle:
+            _oneWire.reset();
+            _oneWire.skip();
+            _oneWire.write(0x44);    // start conversion on all devices
+            // for parasite power devices, e.g. DS18S20P, use ow->write(0x44, 1);
+            _timeStart = millis();
+            _timePoll  = _timeStart;
+            _state     = StateConverting;
+            break;
+        case StateConverting:
+            if ((millis() - _timePoll) >= DS18B20_POLL_INTERVAL) {
+                _timePoll = millis();
+                // read slot returns 1 when the conversion is complete, any device still converting holds the bus low
+                if (_oneWire.read_bit() == 1) {
+                    rc     = true;
+                    _state = StateWaiting;
+                } else if ((millis() - _timeStart) > (_conversionTime + _conversionTime / 4)) {
+                    dbgPrintln(F("Conversion timeout"));
+                    rc     = true;    // read anyway, sensors with invalid data report an error
+                    _state = StateWaiting;
                 }
-            } else {
-                dbgPrint(F("Unknown Device: "));
             }
-            for (uint8_t i = 0; i < 8; i++) {
-                dbgHex(_addr[i]);
+            break;
+        case StateWaiting:
+            if ((millis() - _timeStart) >= _samplePeriod) {
+                _state = StateIdle;
             }
-        } else {
-            dbgPrint(F("No sensor"));
+            break;
+        default:
+            _state = StateIdle;
+            break;
+        }
+        return rc;
+    }
+
+private:
+    friend class DS18B20;
+
+    enum State : uint8_t { StateIdle, StateConverting, StateWaiting };
+
+    ::OneWire     _oneWire;
+    uint8_t       _pin;
+    uint8_t       _deviceCount;
+    State         _state;
+    uint16_t      _samplePeriod;
+    uint16_t      _conversionTime;
+    unsigned long _timeStart;
+    unsigned long _timePoll;
+    unsigned long _probeTime;
+    uint8_t       _probeBackoff;
+
+#ifdef DEBUG_OUTPUT
+    void printAddr(const uint8_t* addr)
+    {
+        for (uint8_t i = 0; i < 8; i++) {
+            dbgHex(addr[i]);
         }
         dbgPrintln("");
+    }
+#else
+    void printAddr(const uint8_t*) {}
+#endif
+};
 
-        _oneWire.reset_search();
+//---------------------------------------------------------
+// single DS18x20 sensor, addressed by its ROM code on a DS18B20BUS
+class DS18B20 {
+
+public:
+    DS18B20()
+        : _bus(nullptr)
+        , _temperature(TEMPERATURE_INVALID)
+        , _resolution(12)
+        , _errors(0)
+    {
+    }
 
-        if (!rc) {
+    // assign the device with this ROM code to the sensor, if it answers on the bus (Match ROM and scratchpad read)
+    bool attach(DS18B20BUS& bus, const uint8_t* rom)
+    {
+        uint8_t data[9];
+        detach();
+        _bus = &bus;
+        memcpy(_addr, rom, sizeof(_addr));
+        if (!DS18B20BUS::isSensor(_addr) || !readScratchpad(data)) {
+            _bus = nullptr;
             memset(_addr, 0, sizeof(_addr));
+            return false;
         }
-        return rc;
+        if (_addr[0] != 0x10) {
+            _resolution = 9 + ((data[4] >> 5) & 0x03);
+        }
+        _errors = 0;
+        bus._deviceCount++;
+        dbgPrint(F("Sensor attached: "));
+        bus.printAddr(_addr);
+        return true;
     }
 
-    void start()
+    // no device assigned
+    void detach()
     {
-        _oneWire.reset();
-        _oneWire.select(_addr);
-        _oneWire.write(0x44);    // start conversion
-        // for parasite power devices, e.g. DS18S20P, use ow->write(0x44, 1);
+        if (_bus != nullptr) {
+            _bus->_deviceCount--;
+        }
+        _bus         = nullptr;
+        _temperature = TEMPERATURE_INVALID;
+        memset(_addr, 0, sizeof(_addr));
     }
 
-    void read()
-    {
-        _temperature = TEMPERATURE_ERROR;
+    bool onBus(const DS18B20BUS& bus) { return _bus == &bus; }
 
-        _oneWire.reset();
-        _oneWire.select(_addr);
-        _oneWire.write(0xBE);    // read scratchpad
+    // ROM code, all 0 without a device
+    const uint8_t* rom() const { return _addr; }
 
+    // resolution in bits (9..12), written to the scratchpad and copied to the sensor EEPROM if changed
+    // DS18S20 sensors have a fixed resolution
+    bool setResolution(uint8_t bits)
+    {
+        if ((_bus == nullptr) || (bits < 9) || (bits > 12) || (_addr[0] == 0x10)) {
+            return false;
+        }
         uint8_t data[9];
-        for (uint8_t i = 0; i < 9; i++) {
-            data[i] = _oneWire.read();
+        if (!readScratchpad(data)) {
+            return false;
+        }
+        uint8_t cfg = ((bits - 9) << 5) | 0x1F;
+        if (data[4] != cfg) {
+            ::OneWire& oneWire = _bus->oneWire();
+            oneWire.reset();
+            oneWire.select(_addr);
+            oneWire.write(0x4E);       // write scratchpad
+            oneWire.write(data[2]);    // keep alarm TH
+            oneWire.write(data[3]);    // keep alarm TL
+            oneWire.write(cfg);
+            oneWire.reset();
+            oneWire.select(_addr);
+            oneWire.write(0x48);    // copy scratchpad to sensor EEPROM
+            ::delay(10);            // EEPROM write time
         }
+        _resolution = bits;
+        return true;
+    }
+
+    uint8_t resolution() { return _resolution; }
+
+    // max. conversion time in ms: 94/188/375/750 for 9/10/11/12 bit
+    uint16_t conversionTime()
+    {
+        uint8_t shift = (_addr[0] == 0x10) ? 0 : 12 - _resolution;
+        return (DS18B20_CONVERSION_TIME + (1 << shift) - 1) >> shift;
+    }
+
+    // false on a read error, the temperature is TEMPERATURE_INVALID then
+    bool read()
+    {
+        _temperature = TEMPERATURE_INVALID;
 
-        if (OneWire::crc8(data, 8) == data[8]) {
+        uint8_t data[9];
+        if (readScratchpad(data)) {
             int16_t raw = ((int16_t)data[1] << 8) | data[0];
             if (_addr[0] == 0x10) {
                 raw = raw << 3;    // 9 bit resolution default
@@ -105,17 +295,42 @@ public:
                 }
             }
             _temperature = (raw * 10) / 16;
-        } else {
-            dbgPrintln(F("CRC Error"));
+            _errors      = 0;
+            return true;
+        }
+        dbgPrintln(F("CRC Error"));
+        if (_errors < 0xFF) {
+            _errors++;
         }
+        return false;
     }
 
     int16_t temperature() { return _temperature; }
 
+    // consecutive read errors
+    uint8_t errors() { return _errors; }
+
 private:
-    ::OneWire _oneWire;
-    int16_t   _temperature;
-    uint8_t   _addr[8];
+    DS18B20BUS* _bus;
+    int16_t     _temperature;
+    uint8_t     _addr[8];
+    uint8_t     _resolution;
+    uint8_t     _errors;
+
+    bool readScratchpad(uint8_t* data)
+    {
+        ::OneWire& oneWire = _bus->oneWire();
+        if (oneWire.reset() == 0) {
+            return false;    // no presence pulse
+        }
+        oneWire.select(_addr);
+        oneWire.write(0xBE);    // read scratchpad
+
+        for (uint8_t i = 0; i < 9; i++) {
+            data[i] = oneWire.read();
+        }
+        return OneWire::crc8(data, 8) == data[8];
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
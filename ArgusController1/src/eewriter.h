@@ -0,0 +1,110 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// eewriter.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _EEWRITER_H_
+#define _EEWRITER_H_
+
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#define EEWRITER_BLOCK_SIZE 32    // max. bytes of one block
+
+#define EEWRITER_IDLE 0     // last block written and verified
+#define EEWRITER_BUSY 1     // block is being written
+#define EEWRITER_ERROR 2    // EEPROM content differs from the last block
+
+// non-blocking EEPROM block write: one byte is programmed whenever the EEPROM is ready, the main loop keeps running
+// (3.4ms per changed byte), the block is verified with its crc8 when complete
+class EEWRITER {
+
+public:
+    EEWRITER()
+        : addr(0)
+        , length(0)
+        , position(0)
+        , crc(0)
+        , state(EEWRITER_IDLE)
+    {
+    }
+
+    // start writing a block, false if a block is still being written or the range is invalid
+    bool start(uint16_t address, const uint8_t* data, uint8_t count)
+    {
+        if ((state == EEWRITER_BUSY) || (count == 0) || (count > EEWRITER_BLOCK_SIZE) || ((uint32_t)address + count > EEPROM.length())) {
+            return false;
+        }
+        addr     = address;
+        length   = count;
+        position = 0;
+        memcpy(block, data, count);
+        crc   = crc8(block, count);
+        state = EEWRITER_BUSY;
+        return true;
+    }
+
+    // program the next byte if the EEPROM is ready, true once when a block is complete
+    bool update()
+    {
+        if ((state != EEWRITER_BUSY) || !eeprom_is_ready()) {
+            return false;
+        }
+        // unchanged bytes are skipped, without waiting for the EEPROM again
+        while ((position < length) && (EEPROM.read(addr + position) == block[position])) {
+            position++;
+        }
+        if (position < length) {
+            EEPROM.write(addr + position, block[position]);    // starts the programming and returns
+            position++;
+            return false;
+        }
+        state = (blockCrc() == crc) ? EEWRITER_IDLE : EEWRITER_ERROR;
+        return true;
+    }
+
+    bool busy() const { return state == EEWRITER_BUSY; }
+
+    // EEWRITER_x
+    uint8_t status() const { return state; }
+
+    uint16_t address() const { return addr; }
+
+    uint8_t count() const { return length; }
+
+    // crc8 of the EEPROM content of the last block
+    uint8_t blockCrc()
+    {
+        uint8_t c = 0;
+        for (uint8_t i = 0; i < length; i++) {
+            c = _crc_ibutton_update(c, EEPROM.read(addr + i));
+        }
+        return c;
+    }
+
+    static uint8_t crc8(const uint8_t* data, uint8_t len)
+    {
+        uint8_t c = 0;
+        while (len--) {
+            c = _crc_ibutton_update(c, *data++);
+        }
+        return c;
+    }
+
+private:
+    uint16_t addr;
+    uint8_t  length;
+    uint8_t  position;    // next byte to program
+    uint8_t  crc;         // crc8 of the block
+    uint8_t  state;
+    uint8_t  block[EEWRITER_BLOCK_SIZE];
+};
+
+#endif
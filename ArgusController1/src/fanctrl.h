@@ -13,146 +13,397 @@
 #ifndef _FANCTRL_H_
 #define _FANCTRL_H_
 
-#define PIN_PWM_FAN1 9     // OC1A
-#define PIN_PWM_FAN2 10    // OC1B
-#define PIN_TACH_FAN1 2    // INT0
-#define PIN_TACH_FAN2 3    // INT1
-#define CYCLES_PER_REVOLUTION 2.0
+#define FANCTRL_UPDATE_PERIOD 250       // ms between rpm updates, period of the update() calls
+#define FANCTRL_STALL_TIMEOUT 1000      // ms without tach edge until rpm is 0
+#define FANCTRL_STALL_ALARM 2000        // ms with pwm > 0 and rpm 0 until a fan stall is reported
+#define FANCTRL_DUTY_MAX (100 * 256)    // duty cycle in % x256
+
+// pwm outputs, fPwm = 25kHz (@16MHz Quarz) -> see Intel specification "4-Wire Pulse Width Modulation (PWM) Controlled Fans"
+// Timer0 is used by millis(), Timer1 and Timer2 are used for the fans
+#define FANPWM_OC1A 0    // pin 9, Timer1, 320 steps
+#define FANPWM_OC1B 1    // pin 10, Timer1, 320 steps
+#define FANPWM_OC2B 2    // pin 3, Timer2, 80 steps, INT1 (pin 3) is no tach input then
+#define PWM_TOP_T1 320    // ICR1
+#define PWM_TOP_T2 79     // OCR2A
+
+// rpm control, PID output in % x256, gains: output = (gain * rpm error) >> 8, see EEADDR_PID_0
+#define PID_KP_DEFAULT 1311    // 0.02 %/rpm
+#define PID_KI_DEFAULT 2621    // 0.04 %/(rpm s)
+#define PID_KD_DEFAULT 0
 
 #include <EEPROM.h>
+#include <util/atomic.h>
 
-class FANCTRL {
+// fan channel descriptor, resolved at compile time
+// PWM:      pwm output FANPWM_x, channels may share an output (e.g. two fans on one pwm signal with separate tach inputs)
+// TACH:     tach input pin, pins 2 and 3 use INT0/INT1, all other pins (0..19) use pin change interrupts
+// INVERTED: pwm signal inverted with a transistor
+// PULSES:   tach pulses per revolution
+template <uint8_t PWM, uint8_t TACH, bool INVERTED = true, uint8_t PULSES = 2> struct FanChannel {
+    static_assert(PWM <= FANPWM_OC2B, "invalid pwm output");
+    static_assert(TACH <= 19, "tach input must be pin 0..19");
+    static_assert(!((PWM == FANPWM_OC2B) && (TACH == 3)), "pin 3 is the OC2B pwm output");
+    static_assert(PULSES > 0, "tach pulses per revolution must be > 0");
 
-public:
-    FANCTRL()
-        : fanCount(0)
-        , lastUpdateTime(0)
-        , rpm { 0 }
+    static const uint8_t output  = PWM;
+    static const uint8_t tachPin = TACH;
+    static const uint8_t pulses  = PULSES;
+
+    static void begin()
     {
+        pinMode(TACH, INPUT);
+        digitalWrite(TACH, HIGH);
+        if (PWM == FANPWM_OC1A) {
+            pinMode(9, OUTPUT);
+            TCCR1A |= 1 << COM1A1;
+        } else if (PWM == FANPWM_OC1B) {
+            pinMode(10, OUTPUT);
+            TCCR1A |= 1 << COM1B1;
+        } else {
+            pinMode(3, OUTPUT);
+            TCCR2A |= 1 << COM2B1;
+        }
     }
 
-    void init(uint8_t fcount)
+    // duty cycle 0..FANCTRL_DUTY_MAX
+    static void write(uint16_t duty)
     {
-        fanCount = fcount;
-        if (fanCount >= 1) {
-            pinMode(PIN_TACH_FAN1, INPUT);
-            digitalWrite(PIN_TACH_FAN1, HIGH);
-            attachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN1), isr_fan1, FALLING);
-            pinMode(PIN_PWM_FAN1, OUTPUT);
+        uint16_t top   = (PWM == FANPWM_OC2B) ? PWM_TOP_T2 : PWM_TOP_T1;
+        uint16_t value = ((uint32_t)duty * top + FANCTRL_DUTY_MAX / 2) / FANCTRL_DUTY_MAX;
+        if (INVERTED) {
+            value = top - value;
+        }
+        if (PWM == FANPWM_OC1A) {
+            OCR1A = value;
+        } else if (PWM == FANPWM_OC1B) {
+            OCR1B = value;
+        } else {
+            OCR2B = value;
+        }
+    }
+};
 
-            TCCR1A = 1 << WGM11 | 1 << COM1A1 | 1 << COM1B1;    // PWM, PhaseCorrect, 0..ICR1 counting
-            TCCR1B = 1 << CS10 | 1 << WGM13;                    // clk/1
-            ICR1   = 320;    // fPwm = 25kHz (@16MHz Quarz) -> see Intel specification "4-Wire Pulse Width Modulation (PWM) Controlled Fans"
-            OCR1A  = 160;    // fan0 50%
+template <class... CH> class FANCTRL {
 
-            if (fanCount >= 2) {
-                pinMode(PIN_TACH_FAN2, INPUT);
-                digitalWrite(PIN_TACH_FAN2, HIGH);
-                attachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN2), isr_fan2, FALLING);
-                pinMode(PIN_PWM_FAN2, OUTPUT);
+public:
+    static const uint8_t count = sizeof...(CH);
 
-                OCR1B = 160;    // fan1 50%
-            }
+    FANCTRL()
+        : rpm { 0 }
+        , duty { 0 }
+        , runTime { 0 }
+        , pid {}
+    {
+    }
+
+    void init()
+    {
+        if (Channels<0, CH...>::uses(FANPWM_OC1A) || Channels<0, CH...>::uses(FANPWM_OC1B)) {
+            TCCR1A = 1 << WGM11;                // PWM, PhaseCorrect, 0..ICR1 counting
+            TCCR1B = 1 << CS10 | 1 << WGM13;    // clk/1
+            ICR1   = PWM_TOP_T1;
+        }
+        if (Channels<0, CH...>::uses(FANPWM_OC2B)) {
+            TCCR2A = 1 << WGM21 | 1 << WGM20;    // Fast PWM, 0..OCR2A counting
+            TCCR2B = 1 << WGM22 | 1 << CS21;     // clk/8
+            OCR2A  = PWM_TOP_T2;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            writePwm(i, FANCTRL_DUTY_MAX / 2);    // 50%
         }
+        Channels<0, CH...>::begin();
+        pcintState[0] = PINB;
+        pcintState[1] = PINC;
+        pcintState[2] = PIND;
 
         // PWM Power-On value from EEPROM
         // you can change the PWM Power-On value from within Argus Monitor and store it to EEPROM permanently
-        for (uint8_t i = 0; i < min(2, fanCount); i++) {
+        for (uint8_t i = 0; i < count; i++) {
             uint8_t pwm = EEPROM.read(EEADDR_PWM_POWERON_0 + i);
             if (pwm <= 100) {
                 setPwm(i, pwm);
             }
+            loadGains(i);
+            runTime[i] = millis();
         }
     }
 
+    // rpm from the averaged tach period since the last update
+    // call every FANCTRL_UPDATE_PERIOD ms (periodic scheduler task), the PID control assumes this period
     void update()
     {
-        if ((millis() - lastUpdateTime) >= 1000) {
-
-            unsigned long t = millis() - lastUpdateTime;
-
-            if (fanCount >= 1) {
-                float frpm;
-
-                // disable interrupt for atomic reading of counter
-                detachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN1));
-                // calculate rpm
-                frpm   = (float)rpmCnt1 * 60000.0 / (float)t / CYCLES_PER_REVOLUTION;
-                rpm[0] = (uint16_t)frpm;
-                // reset counter
-                rpmCnt1 = 0;
-                // enable interrupt again
-                attachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN1), isr_fan1, FALLING);
-
-                if (fanCount >= 2) {
-                    detachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN2));
-                    frpm    = (float)rpmCnt2 * 60000.0 / (float)t / CYCLES_PER_REVOLUTION;
-                    rpm[1]  = (uint16_t)frpm;
-                    rpmCnt2 = 0;
-                    attachInterrupt(digitalPinToInterrupt(PIN_TACH_FAN2), isr_fan2, FALLING);
-                }
-
-                // set new time stamp
-                lastUpdateTime = millis();
+        unsigned long now = millis();
+        for (uint8_t i = 0; i < count; i++) {
+            uint32_t      sum;
+            uint8_t       cnt;
+            unsigned long last;
+
+            // atomic snapshot of the tach values, the isr keeps counting
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                sum           = tach[i].sum;
+                cnt           = tach[i].count;
+                last          = tach[i].last;
+                tach[i].sum   = 0;
+                tach[i].count = 0;
+            }
+
+            if ((cnt > 0) && (sum >= cnt)) {
+                uint32_t period = sum / cnt;    // us per tach cycle
+                rpm[i]          = (60000000UL / Channels<0, CH...>::pulses(i)) / period;
+            } else if ((micros() - last) > (FANCTRL_STALL_TIMEOUT * 1000UL)) {
+                rpm[i] = 0;    // stalled
+            }
+
+            if (pid[i].target > 0) {
+                updatePid(i);
+            }
+
+            if ((rpm[i] > 0) || (duty[i] == 0)) {    // running or switched off
+                runTime[i] = now;
+            }
+        }
+    }
+
+    // fan is driven but has no tach signal
+    bool stalled(uint8_t channel) { return (channel < count) && ((millis() - runTime[channel]) > FANCTRL_STALL_ALARM); }
+
+    // bit n set = fan n stalled
+    uint8_t stallMask()
+    {
+        uint8_t mask = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            if (stalled(i)) {
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+    }
+
+    // the first channel of a pwm output controls it, the other channels sharing the output only report their rpm
+    bool primary(uint8_t channel)
+    {
+        if (channel >= count) {
+            return false;
+        }
+        for (uint8_t i = 0; i < channel; i++) {
+            if (Channels<0, CH...>::output(i) == Channels<0, CH...>::output(channel)) {
+                return false;
             }
         }
+        return true;
     }
 
+    // open loop pwm, ends the rpm control of this channel, false for a secondary channel of a shared output
     bool setPwm(uint8_t channel, uint8_t pwmPercent)
     {
-        if (channel >= fanCount) {
+        if (!primary(channel)) {
             return false;
         }
         if (pwmPercent > 100) {
             return false;
         }
-        uint16_t pwm = ((uint16_t)pwmPercent * 320) / 100;
-        pwm          = 320 - pwm;    // on OCR1x pins, pwm signals are inverted with a transistor
-        if (channel == 0) {
-            OCR1A = pwm;
-        } else if (channel == 1) {
-            OCR1B = pwm;
+        pid[channel].target = 0;
+        writePwm(channel, (uint16_t)pwmPercent * 256);
+        return true;
+    }
+
+    // closed loop rpm control with the tach update rate, 0 = off (keeps the current pwm)
+    // false for a secondary channel of a shared output
+    bool setTargetRpm(uint8_t channel, uint16_t targetRpm)
+    {
+        if (!primary(channel)) {
+            return false;
+        }
+        Pid& p = pid[channel];
+        if ((p.target == 0) && (targetRpm > 0)) {
+            // bumpless start from the current pwm
+            p.integral  = duty[channel];
+            p.lastError = 0;
+            p.output    = p.integral;
         }
+        p.target = targetRpm;
         return true;
     }
 
+    uint16_t getTargetRpm(uint8_t channel) { return (channel < count) ? pid[channel].target : 0; }
+
+    // last rpm error (target - rpm) of the rpm control
+    int16_t getRpmError(uint8_t channel) { return (channel < count) ? pid[channel].lastError : 0; }
+
+    // gain: 0 = Kp, 1 = Ki, 2 = Kd, loaded from EEPROM at EEADDR_PID_0 + channel * EESIZE_PID + 2 * gain
+    // changes the gain in RAM only, the sketch stores it without blocking the main loop
+    bool setGain(uint8_t channel, uint8_t gain, uint16_t value)
+    {
+        if ((channel >= count) || (gain > 2)) {
+            return false;
+        }
+        pid[channel].gain[gain] = value;
+        return true;
+    }
+
+    uint16_t getGain(uint8_t channel, uint8_t gain) { return ((channel < count) && (gain <= 2)) ? pid[channel].gain[gain] : 0; }
+
+    // gains of a channel from EEPROM, defaults for erased values
+    void loadGains(uint8_t channel)
+    {
+        if (channel >= count) {
+            return;
+        }
+        const uint16_t defaults[3] = { PID_KP_DEFAULT, PID_KI_DEFAULT, PID_KD_DEFAULT };
+        for (uint8_t g = 0; g < 3; g++) {
+            uint16_t value;
+            EEPROM.get(EEADDR_PID_0 + channel * EESIZE_PID + 2 * g, value);
+            pid[channel].gain[g] = (value != 0xFFFF) ? value : defaults[g];
+        }
+    }
+
     uint8_t getPwm(uint8_t channel)
     {
-        if (channel >= fanCount) {
+        if (channel >= count) {
             return 0;
         }
-        uint16_t pwm;
-        if (channel == 0) {
-            pwm = OCR1A;
-        } else if (channel == 1) {
-            pwm = OCR1B;
-        }
-        pwm                = 320 - pwm;    // on OCR1x pins, pwm signals are inverted with a transistor
-        uint8_t pwmPercent = pwm * 100 / 320;
-        return (uint8_t)pwmPercent;
+        return (duty[channel] + 128) / 256;
     }
 
     uint16_t getRpm(uint8_t channel)
     {
-        if (channel < fanCount) {
+        if (channel < count) {
             return rpm[channel];
         } else {
             return 0;
         }
     }
 
+    // tach inputs on pin change interrupts, group 0: PCINT0_vect (pins 8..13), 1: PCINT1_vect (A0..A5), 2: PCINT2_vect (pins 0..7)
+    static void pcint(uint8_t group)
+    {
+        uint8_t state     = (group == 0) ? PINB : (group == 1) ? PINC : PIND;
+        uint8_t falling   = pcintState[group] & ~state;
+        pcintState[group] = state;
+        Channels<0, CH...>::pcint(group, falling);
+    }
+
 private:
-    uint8_t       fanCount;
-    unsigned long lastUpdateTime;
-    uint16_t      rpm[2];
-    static int    rpmCnt1, rpmCnt2;
+    uint16_t      rpm[count];
+    uint16_t      duty[count];       // 0..FANCTRL_DUTY_MAX
+    unsigned long runTime[count];    // time stamp of the last update with the fan running or switched off
+
+    struct Pid {
+        uint16_t target;       // rpm, 0 = open loop
+        int16_t  lastError;    // rpm
+        int32_t  integral;     // % x256
+        int32_t  output;       // % x256
+        uint16_t gain[3];      // Kp, Ki, Kd
+    };
+    Pid pid[count];
+
+    // channel descriptor list, I: channel number of the first descriptor
+    // runtime channel numbers are dispatched to the descriptors, the compiler unrolls the recursion
+    template <uint8_t I, class... C> struct Channels {
+        static void    begin() {}
+        static bool    uses(uint8_t) { return false; }
+        static uint8_t output(uint8_t) { return 0xFF; }
+        static uint8_t pulses(uint8_t) { return 1; }
+        static void    write(uint8_t, uint16_t) {}
+        static void    pcint(uint8_t, uint8_t) {}
+    };
+
+    template <uint8_t I, class F, class... C> struct Channels<I, F, C...> {
+        static void begin()
+        {
+            F::begin();
+            if ((F::tachPin == 2) || (F::tachPin == 3)) {
+                attachInterrupt(digitalPinToInterrupt(F::tachPin), tachIsr<I>, FALLING);
+            } else {
+                *digitalPinToPCMSK(F::tachPin) |= 1 << digitalPinToPCMSKbit(F::tachPin);
+                PCICR |= 1 << digitalPinToPCICRbit(F::tachPin);
+            }
+            Channels<I + 1, C...>::begin();
+        }
+
+        static bool uses(uint8_t output) { return (F::output == output) || Channels<I + 1, C...>::uses(output); }
 
-    static void isr_fan1() { rpmCnt1++; }
+        static uint8_t output(uint8_t channel) { return (channel == I) ? F::output : Channels<I + 1, C...>::output(channel); }
+
+        static uint8_t pulses(uint8_t channel) { return (channel == I) ? F::pulses : Channels<I + 1, C...>::pulses(channel); }
+
+        static void write(uint8_t channel, uint16_t value)
+        {
+            if (channel == I) {
+                F::write(value);
+            } else {
+                Channels<I + 1, C...>::write(channel, value);
+            }
+        }
+
+        static void pcint(uint8_t group, uint8_t falling)
+        {
+            if ((F::tachPin != 2) && (F::tachPin != 3) && (digitalPinToPCICRbit(F::tachPin) == group)
+                && (falling & (1 << digitalPinToPCMSKbit(F::tachPin)))) {
+                tachEdge(I);
+            }
+            Channels<I + 1, C...>::pcint(group, falling);
+        }
+    };
+
+    // fixed point PID, called with every rpm update
+    void updatePid(uint8_t channel)
+    {
+        Pid&    p     = pid[channel];
+        int32_t error = (int32_t)p.target - rpm[channel];
+        error         = constrain(error, -32768L, 32767L);
+
+        // integral with anti-windup: clamped to the output range and frozen while the output saturates in the same direction
+        bool saturated = ((p.output >= FANCTRL_DUTY_MAX) && (error > 0)) || ((p.output <= 0) && (error < 0));
+        if (!saturated) {
+            p.integral += (((int32_t)p.gain[1] * error) >> 8) * FANCTRL_UPDATE_PERIOD / 1000;
+            p.integral = constrain(p.integral, 0L, (int32_t)FANCTRL_DUTY_MAX);
+        }
+
+        int32_t output = (((int32_t)p.gain[0] * error) >> 8) + p.integral + (((int32_t)p.gain[2] * (error - p.lastError)) >> 8);
+        p.output       = constrain(output, 0L, (int32_t)FANCTRL_DUTY_MAX);
+        p.lastError    = error;
+
+        writePwm(channel, p.output);
+    }
+
+    // duty cycle 0..FANCTRL_DUTY_MAX, channels sharing the pwm output follow
+    void writePwm(uint8_t channel, uint16_t value)
+    {
+        uint8_t output = Channels<0, CH...>::output(channel);
+        for (uint8_t i = 0; i < count; i++) {
+            if (Channels<0, CH...>::output(i) == output) {
+                duty[i] = value;
+            }
+        }
+        Channels<0, CH...>::write(channel, value);
+    }
+
+    struct Tach {
+        unsigned long last;     // us time stamp of the last edge
+        uint32_t      sum;      // us sum of the tach periods since the last update
+        uint8_t       count;    // number of tach periods since the last update
+    };
+    static volatile Tach tach[count];
+    static uint8_t       pcintState[3];    // PINB, PINC, PIND at the last pin change interrupt
+
+    static inline void tachEdge(uint8_t channel)
+    {
+        unsigned long now    = micros();
+        unsigned long period = now - tach[channel].last;
+        tach[channel].last   = now;
+        // the first edge after a stall has no valid period
+        if ((period < (FANCTRL_STALL_TIMEOUT * 1000UL)) && (tach[channel].count < 0xFF)) {
+            tach[channel].sum   = tach[channel].sum + period;
+            tach[channel].count = tach[channel].count + 1;
+        }
+    }
 
-    static void isr_fan2() { rpmCnt2++; }
+    template <uint8_t I> static void tachIsr() { tachEdge(I); }
 };
 
-int FANCTRL::rpmCnt1 = 0;
-int FANCTRL::rpmCnt2 = 0;
+template <class... CH> volatile typename FANCTRL<CH...>::Tach FANCTRL<CH...>::tach[FANCTRL<CH...>::count];
+template <class... CH> uint8_t FANCTRL<CH...>::pcintState[3];
 
-#endif
\ No newline at end of file
+#endif
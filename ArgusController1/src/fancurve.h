@@ -0,0 +1,216 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// fancurve.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _FANCURVE_H_
+#define _FANCURVE_H_
+
+#include <EEPROM.h>
+
+#define FANCURVE_POINTS 6    // max. curve points per fan
+
+// EEPROM layout of one fan curve, starting at EEADDR_FANCURVE_0 + channel * EESIZE_FANCURVE
+#define FANCURVE_EE_MODE 0           // FANCURVE_MODE_x
+#define FANCURVE_EE_SOURCE 1         // temperature channel
+#define FANCURVE_EE_HYSTERESIS 2     // 0.1C
+#define FANCURVE_EE_SLEWRATE 3       // %/s, 0 = unlimited
+#define FANCURVE_EE_POINTCOUNT 4     // 1..FANCURVE_POINTS
+#define FANCURVE_EE_TEMP 5           // int16_t 0.1C, ascending, FANCURVE_POINTS entries
+#define FANCURVE_EE_PWM (FANCURVE_EE_TEMP + 2 * FANCURVE_POINTS)    // uint8_t %, FANCURVE_POINTS entries
+#define FANCURVE_EE_SIZE (FANCURVE_EE_PWM + FANCURVE_POINTS)         // bytes of one curve
+
+#define FANCURVE_MODE_HOST 0          // pwm set by the host with CmdSetFanPwm
+#define FANCURVE_MODE_AUTONOMOUS 1    // pwm from the fan curve
+
+class FANCURVE {
+
+public:
+    FANCURVE()
+        : eeAddr(0)
+        , mode(FANCURVE_MODE_HOST)
+        , src(0)
+        , hysteresis(0)
+        , slewRate(0)
+        , pointCount(0)
+        , temp { 0 }
+        , pwm { 0 }
+        , tempRef(0)
+        , output(0)
+        , lastUpdateTime(0)
+        , started(false)
+    {
+    }
+
+    // load the curve of one fan from EEPROM
+    void load(uint16_t addr)
+    {
+        eeAddr     = addr;
+        mode       = EEPROM.read(eeAddr + FANCURVE_EE_MODE);
+        src        = EEPROM.read(eeAddr + FANCURVE_EE_SOURCE);
+        hysteresis = EEPROM.read(eeAddr + FANCURVE_EE_HYSTERESIS);
+        slewRate   = EEPROM.read(eeAddr + FANCURVE_EE_SLEWRATE);
+        pointCount = EEPROM.read(eeAddr + FANCURVE_EE_POINTCOUNT);
+        for (uint8_t i = 0; i < FANCURVE_POINTS; i++) {
+            EEPROM.get(eeAddr + FANCURVE_EE_TEMP + 2 * i, temp[i]);
+            pwm[i] = EEPROM.read(eeAddr + FANCURVE_EE_PWM + i);
+        }
+        started = false;
+    }
+
+    // point count, pwm values and ascending temperatures are valid
+    bool valid()
+    {
+        if ((pointCount < 1) || (pointCount > FANCURVE_POINTS)) {
+            return false;
+        }
+        for (uint8_t i = 0; i < pointCount; i++) {
+            if ((pwm[i] > 100) || ((i > 0) && (temp[i] <= temp[i - 1]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // autonomous mode is only active with a valid curve
+    bool autonomous() { return (mode == FANCURVE_MODE_AUTONOMOUS) && valid(); }
+
+    uint8_t source() { return src; }
+
+    // EEPROM address of the curve, see load()
+    uint16_t address() { return eeAddr; }
+
+    // the curve in its EEPROM layout, returns FANCURVE_EE_SIZE
+    // the setters change the curve in RAM only, the sketch stores the image without blocking the main loop
+    uint8_t image(uint8_t* buf)
+    {
+        buf[FANCURVE_EE_MODE]       = mode;
+        buf[FANCURVE_EE_SOURCE]     = src;
+        buf[FANCURVE_EE_HYSTERESIS] = hysteresis;
+        buf[FANCURVE_EE_SLEWRATE]   = slewRate;
+        buf[FANCURVE_EE_POINTCOUNT] = pointCount;
+        for (uint8_t i = 0; i < FANCURVE_POINTS; i++) {
+            buf[FANCURVE_EE_TEMP + 2 * i]     = temp[i] & 0xFF;    // low byte first, like EEPROM.put()
+            buf[FANCURVE_EE_TEMP + 2 * i + 1] = temp[i] >> 8;
+            buf[FANCURVE_EE_PWM + i]          = pwm[i];
+        }
+        return FANCURVE_EE_SIZE;
+    }
+
+    bool setMode(uint8_t value)
+    {
+        if ((value != FANCURVE_MODE_HOST) && (value != FANCURVE_MODE_AUTONOMOUS)) {
+            return false;
+        }
+        mode    = value;
+        started = false;
+        return true;
+    }
+
+    // param: FANCURVE_EE_SOURCE, FANCURVE_EE_HYSTERESIS, FANCURVE_EE_SLEWRATE or FANCURVE_EE_POINTCOUNT
+    bool setParam(uint8_t param, uint8_t value)
+    {
+        switch (param) {
+        case FANCURVE_EE_SOURCE:
+            src = value;
+            break;
+        case FANCURVE_EE_HYSTERESIS:
+            hysteresis = value;
+            break;
+        case FANCURVE_EE_SLEWRATE:
+            slewRate = value;
+            break;
+        case FANCURVE_EE_POINTCOUNT:
+            if ((value < 1) || (value > FANCURVE_POINTS)) {
+                return false;
+            }
+            pointCount = value;
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+    bool setPoint(uint8_t point, int16_t temperature, uint8_t pwmPercent)
+    {
+        if ((point >= FANCURVE_POINTS) || (pwmPercent > 100)) {
+            return false;
+        }
+        temp[point] = temperature;
+        pwm[point]  = pwmPercent;
+        return true;
+    }
+
+    // pwm for a new temperature sample of the source channel
+    // without a valid temperature, the fan runs at 100%
+    uint8_t update(int16_t temperature, bool temperatureValid)
+    {
+        unsigned long dt = millis() - lastUpdateTime;
+        lastUpdateTime   = millis();
+
+        uint8_t target = 100;
+        if (temperatureValid) {
+            // hysteresis: follow rising temperatures at once, falling ones only beyond the hysteresis
+            if (!started || (temperature > tempRef)) {
+                tempRef = temperature;
+            } else if (temperature < (tempRef - hysteresis)) {
+                tempRef = temperature + hysteresis;
+            }
+            target = interpolate(tempRef);
+        }
+
+        // slew rate limit, output in 0.01%
+        uint16_t targetOutput = target * 100;
+        if (!started || (slewRate == 0)) {
+            output = targetOutput;
+        } else {
+            uint32_t maxStep = (uint32_t)slewRate * dt / 10;
+            if (targetOutput > output) {
+                output = ((uint16_t)(targetOutput - output) > maxStep) ? output + maxStep : targetOutput;
+            } else {
+                output = ((uint16_t)(output - targetOutput) > maxStep) ? output - maxStep : targetOutput;
+            }
+        }
+        started = true;
+        return (output + 50) / 100;
+    }
+
+private:
+    uint16_t      eeAddr;
+    uint8_t       mode;
+    uint8_t       src;
+    uint8_t       hysteresis;
+    uint8_t       slewRate;
+    uint8_t       pointCount;
+    int16_t       temp[FANCURVE_POINTS];
+    uint8_t       pwm[FANCURVE_POINTS];
+    int16_t       tempRef;    // temperature after hysteresis
+    uint16_t      output;     // 0.01%
+    unsigned long lastUpdateTime;
+    bool          started;
+
+    // linear interpolation between the curve points, constant outside
+    uint8_t interpolate(int16_t temperature)
+    {
+        if (temperature <= temp[0]) {
+            return pwm[0];
+        }
+        for (uint8_t i = 1; i < pointCount; i++) {
+            if (temperature < temp[i]) {
+                int32_t dT = temp[i] - temp[i - 1];
+                int32_t dP = (int16_t)pwm[i] - pwm[i - 1];
+                return pwm[i - 1] + (dP * (temperature - temp[i - 1]) + dT / 2) / dT;
+            }
+        }
+        return pwm[pointCount - 1];
+    }
+};
+
+#endif
@@ -0,0 +1,138 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// history.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#define HISTORY_ESCAPE 0x80    // delta byte: an absolute value (high byte first) follows
+#define HISTORY_DELTA_MAX 127
+
+// sample history of CHANNELS int16_t values in a ring of SIZE samples, SRAM: SIZE * CHANNELS * 2 bytes
+// every sample gets a sequence number, min., max. and average of each channel run since the last resetStats()
+// TEMPERATURE_INVALID samples are stored in the ring, but not counted in min., max. and average
+template <uint8_t CHANNELS, uint8_t SIZE> class HISTORY {
+
+    static_assert((SIZE >= 2) && (SIZE <= 128), "HISTORY SIZE must be 2..128");
+
+public:
+    HISTORY()
+        : head(0)
+        , stored(0)
+        , sequence(0)
+    {
+        resetStats();
+    }
+
+    // one value per channel
+    void add(const int16_t* values)
+    {
+        for (uint8_t i = 0; i < CHANNELS; i++) {
+            data[head][i] = values[i];
+            if (values[i] == TEMPERATURE_INVALID) {
+                continue;
+            }
+            if (statCount[i] >= 0x8000) {    // halve the sum, keeps the average without an overflow
+                sum[i] /= 2;
+                statCount[i] /= 2;
+            }
+            if ((statCount[i] == 0) || (values[i] < minValue[i])) {
+                minValue[i] = values[i];
+            }
+            if ((statCount[i] == 0) || (values[i] > maxValue[i])) {
+                maxValue[i] = values[i];
+            }
+            sum[i] += values[i];
+            statCount[i]++;
+        }
+        head = (head + 1 < SIZE) ? head + 1 : 0;
+        if (stored < SIZE) {
+            stored++;
+        }
+        sequence++;
+    }
+
+    // number of samples in the ring
+    uint8_t count() const { return stored; }
+
+    // sequence number of the next sample, wraps around
+    uint8_t nextSequence() const { return sequence; }
+
+    // samples of a channel starting at seq, the first value absolute (high byte first), the following as
+    // int8_t deltas to their predecessor or HISTORY_ESCAPE and the absolute value, as many as fit into size bytes
+    // seq is set to the first returned sample: the oldest sample, if seq is not in the ring any more
+    // returns the number of bytes, samples: number of returned samples
+    uint8_t encode(uint8_t channel, uint8_t& seq, uint8_t& samples, uint8_t* buf, uint8_t size) const
+    {
+        uint8_t len = 0;
+        samples     = 0;
+        uint8_t age = sequence - seq;    // samples from seq to the newest, 0 = none
+        if (age > stored) {
+            age = stored;    // lost samples, continue with the oldest
+        }
+        seq = sequence - age;
+        if (channel >= CHANNELS) {
+            return 0;
+        }
+        uint8_t index = (head + SIZE - age) % SIZE;
+        int16_t prev  = 0;
+        for (; samples < age; samples++) {
+            int16_t value = data[index][channel];
+            int16_t delta = value - prev;
+            if ((samples > 0) && (delta >= -HISTORY_DELTA_MAX) && (delta <= HISTORY_DELTA_MAX)) {
+                if (len + 1 > size) {
+                    break;
+                }
+                buf[len++] = delta;
+            } else {
+                if (len + ((samples > 0) ? 3 : 2) > size) {
+                    break;
+                }
+                if (samples > 0) {
+                    buf[len++] = HISTORY_ESCAPE;
+                }
+                buf[len++] = value >> 8;
+                buf[len++] = value & 0xFF;
+            }
+            prev  = value;
+            index = (index + 1 < SIZE) ? index + 1 : 0;
+        }
+        return len;
+    }
+
+    // since the last resetStats(), TEMPERATURE_INVALID without a valid sample
+    int16_t minimum(uint8_t channel) const { return valid(channel) ? minValue[channel] : TEMPERATURE_INVALID; }
+
+    int16_t maximum(uint8_t channel) const { return valid(channel) ? maxValue[channel] : TEMPERATURE_INVALID; }
+
+    int16_t average(uint8_t channel) const { return valid(channel) ? sum[channel] / statCount[channel] : TEMPERATURE_INVALID; }
+
+    void resetStats()
+    {
+        for (uint8_t i = 0; i < CHANNELS; i++) {
+            sum[i]       = 0;
+            statCount[i] = 0;
+        }
+    }
+
+private:
+    int16_t  data[SIZE][CHANNELS];
+    uint8_t  head;        // index of the next sample
+    uint8_t  stored;      // samples in the ring
+    uint8_t  sequence;    // sequence number of the next sample
+    int16_t  minValue[CHANNELS];
+    int16_t  maxValue[CHANNELS];
+    int32_t  sum[CHANNELS];
+    uint16_t statCount[CHANNELS];    // valid samples in the sums
+
+    bool valid(uint8_t channel) const { return (channel < CHANNELS) && (statCount[channel] > 0); }
+};
+
+#endif
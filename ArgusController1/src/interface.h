@@ -17,21 +17,128 @@ Protocol
 
 Command             Argus Monitor request                       Argus Controller answer
 ProbeDevice         AA 02 01 crc8                               C5 <byteCnt> 01 <DEVICE_ID> <TEMP_COUNT> <FAN_COUNT> crc8
+GetCaps             AA 02 02 crc8                               C5 <byteCnt> 02 <CAPS_COUNT> <CAPS0> <CAPS1> crc8
 GetTemp             AA 02 20 crc8                               C5 <byteCnt> 20 <TEMP_COUNT> temp0_H temp0_L temp1_H temp1_L temp2_H temp2_L temp3_H temp3_L crc8
+RescanSensors       AA 03 21 <mode> crc8                        C5 <byteCnt> 21/FF crc8                         # answer byte2: 21 = rescan started, FF = error
 GetFanRpm           AA 02 30 crc8                               C5 <byteCnt> 30 <FAN_COUNT> rpm0_H rpm0_L rpm1_H rpm1_L crc8
 GetFanPwm           AA 03 31 <channel> crc8                     C5 <byteCnt> 31 <channel> <pwm> crc8
 SetFanPwm           AA 04 32 <channel> <pwm> crc8               C5 <byteCnt> 32/FF crc8                         # answer byte2: 32 = ok, FF = error
 EEReadByte          AA 04 40 <addrH> <addrL> crc8               C5 <byteCnt> 40 <VALUE_COUNT> <val> crc8
 EEWriteByte         AA 05 41 <addrH> <addrL> <value> crc8       C5 <byteCnt> 41/FF crc8                         # answer byte2: 41 = ok, FF = error
+EEReadBlock         AA 05 42 <addrH> <addrL> <count> crc8       C5 <byteCnt> 42/FF <addrH> <addrL> <count> data0 .. <dataCrc> crc8
+EEWriteBlock        AA <byteCnt> 43 <addrH> <addrL> data0 .. <dataCrc> crc8   C5 <byteCnt> 43/FF crc8             # answer byte2: 43 = write started, FF = error
+EEWriteStatus       AA 02 44 crc8                               C5 <byteCnt> 44 <EESTATE> <addrH> <addrL> <count> crc8
+GetAll              AA 02 50 crc8                               C5 <byteCnt> 50 <SEQ> <STATUS> <TEMP_COUNT> temp0_H temp0_L .. <FAN_COUNT> rpm0_H rpm0_L .. pwm0 .. crc8
+SetStream           AA 05 51 <keepAlive> <tempDb> <rpmDb> crc8  C5 <byteCnt> 51 crc8
+Telemetry           (unsolicited, while streaming is enabled)   C5 <byteCnt> 52 <SEQ> <STATUS> ..                 # same payload as GetAll
+SetBaud             AA 03 53 <baudCode> crc8                    C5 <byteCnt> 53/FF crc8                         # answer byte2: 53 = ok, FF = error
+GetStatus           AA 02 54 crc8                               C5 <byteCnt> 54 <ALARM> <STALL> <ABSENT> crc8
+GetStats            AA 04 55 <reset> <cmd> crc8                 C5 <byteCnt> 55 <rxFrames> <crcErrors> <parserResets> <txFrames> <queueHigh> <queueDrops> <loopAvg> <loopMax> <cmd> <latencyAvg> <latencyMax> <sampleAge> <idle> crc8
+GetHistory          AA 05 56 <channel> <HSEQ> <reset> crc8      C5 <byteCnt> 56/FF <channel> <HSEQ> <count> <min> <max> <avg> val0_H val0_L <delta1> .. crc8
+SetFanRpm           AA 05 33 <channel> <rpmH> <rpmL> crc8       C5 <byteCnt> 33/FF crc8                         # answer byte2: 33 = ok, FF = error
+GetFanRpmCtrl       AA 03 34 <channel> crc8                     C5 <byteCnt> 34 <channel> <targetH> <targetL> <errorH> <errorL> <pwm> crc8
+SetPidGain          AA 05 35 <gain|channel> <valH> <valL> crc8  C5 <byteCnt> 35/FF crc8                         # answer byte2: 35 = ok, FF = error
+SetFanMode          AA 04 60 <channel> <mode> crc8              C5 <byteCnt> 60/FF crc8                         # answer byte2: 60 = ok, FF = error
+SetCurveParam       AA 05 61 <channel> <param> <value> crc8     C5 <byteCnt> 61/FF crc8                         # answer byte2: 61 = ok, FF = error
+SetCurvePoint       AA 05 62 <point|channel> <temp> <pwm> crc8  C5 <byteCnt> 62/FF crc8                         # answer byte2: 62 = ok, FF = error
 
 Data formats
-  temperature: int16_t, scaled by 10
+  temperature: int16_t, scaled by 10, 0x8000 = no valid value (no sensor, read error, open or shorted NTC)
   rpm: uint16_t
   pwm: uint8_t [0..100 %]
+  CAPS0: uint8_t, bit mask of optional commands supported by the device, see AMAC_CAP
+  CAPS1: uint8_t, bit mask of further features, see AMAC_CAP1, RescanSensors only with DS18B20 channels
+  CAPS_COUNT: number of CAPS bytes, later versions may append more, hosts ignore the bytes they do not know
+        devices without GetCaps do not answer it
+  SEQ: uint8_t, sample sequence number, incremented with every new temperature measurement
+  STATUS: uint8_t, bit n set = temperature channel n has a valid temperature, bit 7 set = alarm (see GetStatus)
+  keepAlive: uint8_t, s, max. time between Telemetry frames, 0 = streaming off
+  tempDb: uint8_t, 0.1C, temperature deadband, rpmDb: uint8_t, rpm deadband
+        a Telemetry frame is sent after a new measurement or rpm update (every 250ms) if any value changed more than its deadband or keepAlive elapsed
+
+DS18B20 sensor assignment
+  The ROM code of the sensor of each temperature channel is stored in EEPROM (EEADDR_ROM_0).
+  At startup, the stored sensors are checked with a Match ROM read, a pin is searched only if a channel on it has no answering sensor.
+  Sensors found by the search take the free channels of their pin in search order, a replaced sensor takes the channel of the old one.
+  mode: 0 = keep the answering sensors and search for missing ones, 1 = forget the stored ROM codes, all channels in search order
+  RescanSensors is answered at once, the pins are searched one by one in the background. FF: invalid mode or no DS18B20 channels.
+
+Rpm control
+  SetFanRpm starts a closed loop PID rpm control of the channel, rpm 0 or SetFanPwm ends it.
+  error: int16_t, target - current rpm
+  gain|channel: gain (0 = Kp, 1 = Ki, 2 = Kd) in the high nibble, fan channel in the low nibble, stored in EEPROM
+  gains are fixed point, pwm change [% x256] = (gain * rpm error) >> 8, Ki per second
+  Fan channels sharing a pwm output: only the first of them controls the output.
+  SetFanPwm, SetFanRpm and SetFanMode 1 are rejected with FF for the other channels, they report rpm and follow the pwm of the first one.
+
+Failsafe and alarms
+  ALARM: uint8_t, bit mask of AMAC_ALARM, 01 = failsafe active, 02 = fan stall, 04 = last reset by the hardware watchdog
+  STALL: uint8_t, bit n set = fan n has pwm > 0 but no tach signal
+  ABSENT: uint8_t, bit n set = DS18B20 channel n has no sensor, always 0 for NTC and fake channels
+        a sensor with 3 consecutive read errors is treated as lost, the pins with missing sensors are probed again
+        (see DS18B20 sensor assignment) after 1s, the time doubles with every failed probe up to 64s
+  After the first valid message, the device expects further messages within the failsafe timeout (EEPROM, default 10s).
+  Without them, fans in host mode run their failsafe pwm (EEPROM), fans without failsafe pwm follow their fan curve
+  or run at 100% without a valid curve. The next valid message ends the failsafe, the host sets the fans again.
+
+Multi-drop bus (e.g. RS-485)
+  Addressed messages carry the bus address after the length byte, the length byte counts the address:
+    request  AB <byteCnt> <ADDR> <cmd> .. crc8     e.g. GetTemp for device 3: AB 03 03 20 crc8
+    answer   C6 <byteCnt> <ADDR> <cmd> .. crc8     same payload as the answer to the plain message
+  ADDR: 1..254, device id and bus address, EEPROM 0x3F (0 or FF: DEVICE_ID), also reported by ProbeDevice
+  Devices ignore addressed messages for other addresses, plain messages (AA) are answered by every device.
+  ADDR 0 = broadcast: ProbeDevice is answered by every device in its slot, ADDR * 4ms after the request,
+  other commands are executed without answer, SetBaud is ignored.
+  Answers start at least 0.5ms after the request (bus turnaround), PIN_RS485_DE (if defined) drives the transmitter enable.
+  After an addressed message, no Telemetry messages are sent.
+
+EEPROM blocks
+  addrH, addrL: same byte order as for EEReadByte and EEWriteByte
+  count: 1..32 data bytes, dataCrc: crc8 of the data bytes (same algorithm as the message crc8)
+  EEWriteBlock is answered at once, the block is written in the background (3.4ms per changed byte) and verified with dataCrc.
+  It is rejected while the previous block is being written. EEWriteByte waits for a running write and is written in the background the same way.
+  EESTATE: uint8_t, state of the last written block or byte, 0 = written and verified, 1 = busy, 2 = verify error
+
+Statistics
+  reset: 0 = keep the counters, 1 = reset all counters and times after the answer
+  cmd: command whose service latency is returned, 0 = all commands
+  rxFrames, crcErrors, parserResets, txFrames: uint16_t, message counters, wrap around
+        parserResets: incomplete messages dropped after 250ms
+  queueHigh: uint8_t, command queue high-water mark, queueDrops: uint8_t, commands dropped on a full queue
+  loopAvg, loopMax: uint16_t [us], moving average and max. busy time of a scheduler pass (without the idle sleep)
+  latencyAvg, latencyMax: uint16_t [us], moving average and max. time from message reception to the queued answer
+  sampleAge: uint16_t [ms], time since the last temperature measurement
+  idle: uint8_t [%], time the MCU slept in the last second
+  uint16_t values are sent high byte first, times saturate at 65535
+
+Sample history
+  The device keeps the last HISTORY_SIZE samples (default 16) of every channel, one sample per HISTORY_PERIOD (default 1s).
+  channel: 0..TEMP_COUNT-1 = temperature, TEMP_COUNT.. = rpm of fan channel - TEMP_COUNT,
+           TEMP_COUNT+FAN_COUNT = time stamp of the sample [0.1s], uint16_t, wraps around
+  HSEQ: uint8_t, history sequence number, incremented with every history sample
+        request: first wanted sample, answer: first returned sample, the oldest stored sample if HSEQ is not stored any more
+  count: number of returned samples, as many as fit into a message, 0 = no sample since HSEQ
+  min, max, avg: int16_t, of all valid samples since the last reset, high byte first, 8000 without a valid sample
+  val0: first sample, int16_t, delta: int8_t, sample - previous sample, 80 = escape, the sample follows as int16_t
+  reset: 1 = reset min, max and avg after the answer
+  The host polls with the HSEQ of the last answer + count, a HSEQ different from the requested one means lost samples.
+
+Fan curves
+  mode: 0 = pwm set by the host (default), 1 = autonomous, pwm from the fan curve, SetFanPwm is rejected
+  param: 1 = source temperature channel, 2 = hysteresis [0.1C], 3 = slew rate [%/s, 0 = unlimited], 4 = point count [1..6]
+  point|channel: curve point (0..5) in the high nibble, fan channel in the low nibble
+  temp: int8_t [C], curve point temperatures must be ascending
+  The curves are stored in EEPROM and evaluated after every new temperature measurement.
+  Without a valid temperature of the source channel, the fan runs at 100%.
 
 Communication parameters
 57600 Baud, 8N1
 
+SetBaud switches to a higher baud rate, baudCode: 0 = 57600, 1 = 115200, 2 = 250000, 3 = 500000, 4 = 1000000
+The device answers at the old baud rate and switches after the answer is sent.
+Without a valid message at the new baud rate within 3s after the switch, the device falls back to 57600 Baud.
+After the first valid message, it falls back after 10s without a valid message, so a restarted host can probe the device at 57600 Baud.
+
 Only for the ProbeDevice command, Argus Monitor expects the answer from the device within 200msec.
 
 If the 'Argus Controller hardware support' option in Settings/Stability is enabled,
@@ -46,21 +153,96 @@ It will use the first 4 devices (if specified and available) as additional HW Mo
 
 
 enum AMAC_CMD {
-    CmdUndefined   = 0x00,
-    CmdProbeDevice = 0x01,
-    CmdGetTemp     = 0x20,
-    CmdGetFanRpm   = 0x30,
-    CmdGetFanPwm   = 0x31,
-    CmdSetFanPwm   = 0x32,
-    CmdEEReadByte  = 0x40,
-    CmdEEWriteByte = 0x41,
-    CmdError       = 0xFF
+    CmdUndefined     = 0x00,
+    CmdProbeDevice   = 0x01,
+    CmdGetCaps       = 0x02,
+    CmdGetTemp       = 0x20,
+    CmdRescanSensors = 0x21,
+    CmdGetFanRpm     = 0x30,
+    CmdGetFanPwm     = 0x31,
+    CmdSetFanPwm     = 0x32,
+    CmdSetFanRpm     = 0x33,
+    CmdGetFanRpmCtrl = 0x34,
+    CmdSetPidGain    = 0x35,
+    CmdEEReadByte    = 0x40,
+    CmdEEWriteByte   = 0x41,
+    CmdEEReadBlock   = 0x42,
+    CmdEEWriteBlock  = 0x43,
+    CmdEEWriteStatus = 0x44,
+    CmdGetAll        = 0x50,
+    CmdSetStream     = 0x51,
+    CmdTelemetry     = 0x52,
+    CmdSetBaud       = 0x53,
+    CmdGetStatus     = 0x54,
+    CmdGetStats      = 0x55,
+    CmdGetHistory    = 0x56,
+    CmdSetFanMode    = 0x60,
+    CmdSetCurveParam = 0x61,
+    CmdSetCurvePoint = 0x62,
+    CmdError         = 0xFF
+};
+
+enum AMAC_CAP {
+    CapGetAll = 0x01,
+    CapStream = 0x02,
+    CapBaud   = 0x04,
+    CapCurve  = 0x08,
+    CapRpm    = 0x10,
+    CapStatus = 0x20,
+    CapStats  = 0x40,
+    CapBlock  = 0x80,
+};
+
+#define AMAC_CAPABILITIES (CapGetAll | CapStream | CapBaud | CapCurve | CapRpm | CapStatus | CapStats | CapBlock)
+
+enum AMAC_CAP1 {
+    CapAddressed = 0x01,    // addressed messages on a multi-drop bus
+    CapHistory   = 0x02,
+    CapRescan    = 0x04,
 };
 
+#define AMAC_CAPABILITIES1 (CapAddressed | CapHistory)    // CapRescan depends on the temperature channels
+
+enum AMAC_ALARM {
+    AlarmFailsafe = 0x01,
+    AlarmStall    = 0x02,
+    AlarmWatchdog = 0x04,
+};
+
+#define TEMPERATURE_INVALID (-32767 - 1)    // 0x8000, temperature of a channel without a valid value
+
 #define EEADDR_PWM_POWERON_0 0x28
 #define EEADDR_PWM_POWERON_1 0x29
 #define EEADDR_PWM_POWERON_2 0x2A
 #define EEADDR_PWM_POWERON_3 0x2B
+#define EEADDR_PWM_POWERON_4 0x2C
+#define EEADDR_PWM_POWERON_5 0x2D
+
+#define EEADDR_TEMP_RESOLUTION_0 0x30    // DS18B20 resolution 9..12 bit, other values: keep the sensor setting
+#define EEADDR_TEMP_RESOLUTION_1 0x31
+#define EEADDR_TEMP_RESOLUTION_2 0x32
+#define EEADDR_TEMP_RESOLUTION_3 0x33
+#define EEADDR_TEMP_RESOLUTION_4 0x34
+#define EEADDR_TEMP_RESOLUTION_5 0x35
+
+#define EEADDR_FAILSAFE_TIMEOUT 0x38    // s without a valid host message until failsafe, 0 = off, 0xFF = FAILSAFE_TIMEOUT
+#define EEADDR_FAILSAFE_PWM_0 0x39      // failsafe pwm 0..100 % of fan 0, other values: fan curve
+#define EEADDR_FAILSAFE_PWM_1 0x3A
+#define EEADDR_FAILSAFE_PWM_2 0x3B
+#define EEADDR_FAILSAFE_PWM_3 0x3C
+#define EEADDR_FAILSAFE_PWM_4 0x3D
+#define EEADDR_FAILSAFE_PWM_5 0x3E
+
+#define EEADDR_DEVICE_ID 0x3F    // device id and bus address 1..254, 0 or 0xFF: DEVICE_ID
+
+#define EEADDR_FANCURVE_0 0x40    // fan curve of fan 0, see fancurve.h for the layout
+#define EESIZE_FANCURVE 0x20      // fan curve of fan n at EEADDR_FANCURVE_0 + n * EESIZE_FANCURVE
+
+#define EEADDR_PID_0 0x100    // rpm control gains Kp, Ki, Kd (uint16_t) of fan 0, 0xFFFF: default
+#define EESIZE_PID 0x08       // gains of fan n at EEADDR_PID_0 + n * EESIZE_PID
+
+#define EEADDR_ROM_0 0x140    // DS18B20 ROM code of temperature channel 0, invalid code: no sensor assigned
+#define EESIZE_ROM 0x08       // ROM code of channel n at EEADDR_ROM_0 + n * EESIZE_ROM
 
 
 #endif
@@ -18,56 +18,214 @@
 #ifndef _NTCSENSOR_H_
 #define _NTCSENSOR_H_
 
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
 #define MAX_NTC 6
 
+#define NTC_OVERSAMPLING 64    // ADC samples per channel and scan, 16..64
+#define NTC_RESULT_SHIFT 4     // oversampled results are ADC codes x16
+
+#define NTC_VALID_MIN (8 << NTC_RESULT_SHIFT)       // ADC codes x16, below: open NTC
+#define NTC_VALID_MAX (1015 << NTC_RESULT_SHIFT)    // above: shorted NTC
+
+#define NTC_TABLE_SHIFT 4                                  // table step: 16 ADC codes, linear interpolation in between
+#define NTC_TABLE_SIZE ((1024 >> NTC_TABLE_SHIFT) + 1)    // 65 entries, 130 bytes flash per thermistor type
+
+//---------------------------------------------------------
+// compile time helpers for the temperature tables
+
+// ln(x) for x > 0, reduced to [1..2) and summed as 2 * atanh((x - 1) / (x + 1))
+constexpr double ntcLnSeries(double y, double y2, uint8_t n)
+{
+    return (n > 31) ? 0.0 : y / n + ntcLnSeries(y * y2, y2, n + 2);
+}
+constexpr double ntcLnReduced(double x)
+{
+    return 2.0 * ntcLnSeries((x - 1.0) / (x + 1.0), ((x - 1.0) / (x + 1.0)) * ((x - 1.0) / (x + 1.0)), 1);
+}
+constexpr double ntcLn(double x)
+{
+    return (x >= 2.0) ? 0.6931471805599453 + ntcLn(x / 2.0) : ((x < 1.0) ? -0.6931471805599453 + ntcLn(x * 2.0) : ntcLnReduced(x));
+}
+
+// thermistor types, Steinhart-Hart coefficients A, B, C and series resistor R to Gnd
+struct NTC_10K_SH {    // 10k NTC of the example circuit
+    static constexpr double A = 0.001129148;
+    static constexpr double B = 0.000234125;
+    static constexpr double C = 0.0000000876741;
+    static constexpr double R = 10000.0;
+};
+
+// beta model: R0 at 25C, BETA, series resistor RS
+template <uint32_t R0, uint16_t BETA, uint32_t RS> struct NTC_BETA {
+    static constexpr double A = 1.0 / 298.15 - ntcLn(R0) / BETA;
+    static constexpr double B = 1.0 / BETA;
+    static constexpr double C = 0.0;
+    static constexpr double R = RS;
+};
+typedef NTC_BETA<10000, 3950, 10000> NTC_10K_3950;
+
+// temperature x10 at an ADC code, the NTC is connected to Vcc: Rntc = R * 1024 / adc - R
+template <class NTC> constexpr double ntcKelvin(double lnR)
+{
+    return 1.0 / (NTC::A + NTC::B * lnR + NTC::C * lnR * lnR * lnR);
+}
+template <class NTC> constexpr int16_t ntcTemperature(uint16_t adc)
+{
+    return (adc < 1) ? ntcTemperature<NTC>(1)
+                     : ((adc > 1023) ? ntcTemperature<NTC>(1023)
+                                     : (int16_t)((ntcKelvin<NTC>(ntcLn(NTC::R * 1024.0 / adc - NTC::R)) - 273.15) * 10.0 + 0.5));
+}
+
+template <uint16_t... I> struct NtcIndexList {
+};
+template <uint16_t N, uint16_t... I> struct NtcMakeIndexList : NtcMakeIndexList<N - 1, N - 1, I...> {
+};
+template <uint16_t... I> struct NtcMakeIndexList<0, I...> {
+    typedef NtcIndexList<I...> type;
+};
+
+template <class NTC, class LIST> struct NtcTableData;
+template <class NTC, uint16_t... I> struct NtcTableData<NTC, NtcIndexList<I...>> {
+    static constexpr int16_t table[sizeof...(I)] PROGMEM = { ntcTemperature<NTC>(I << NTC_TABLE_SHIFT)... };    // constexpr: fails to compile unless evaluated at compile time
+};
+template <class NTC, uint16_t... I> constexpr int16_t NtcTableData<NTC, NtcIndexList<I...>>::table[sizeof...(I)];
+
+// temperature table of a thermistor type in flash, generated at compile time
+// e.g. NtcTable<NTC_10K_3950>::table
+template <class NTC> struct NtcTable : NtcTableData<NTC, typename NtcMakeIndexList<NTC_TABLE_SIZE>::type> {
+};
+
+//---------------------------------------------------------
 class NTCSENSOR {
 
 public:
     NTCSENSOR()
         : _temperature{ 0 }
         , _adcpin{ 0 }
+        , _table{ nullptr }
         , _tempCount(0)
+        , _result{ { 0 } }
+        , _back(0)
+        , _scanCount(0)
+        , _scanRead(0)
+        , _channel(0)
+        , _samples(0)
+        , _sum(0)
+        , _discard(true)
     {
     }
 
-    bool addPin(uint8_t pin)
+    bool addPin(uint8_t pin, const int16_t* table = NtcTable<NTC_10K_SH>::table)
     {
         if (_tempCount < MAX_NTC) {
-            _adcpin[_tempCount] = pin;
+            _adcpin[_tempCount]      = (pin >= A0) ? pin - A0 : pin;    // ADC channel
+            _table[_tempCount]       = table;
+            _temperature[_tempCount] = TEMPERATURE_INVALID;    // until the first scan
             _tempCount++;
             return true;
         }
         return false;
     }
 
-    void read()
+    // start the background ADC scan of all added channels, ADC interrupt must call isr()
+    void begin()
     {
-        for (uint8_t i = 0; i < _tempCount; i++) {
-            if (_adcpin[i] != 0) {
-                float analogValue   = analogRead(_adcpin[i]);
-                float resistorValue = (1023.0 / analogValue) - 1.0;
-                resistorValue       = 10000.0 / resistorValue;
-                double temp         = log(((10240000.0 / analogValue) - 10000.0));
-                double kelvin       = 1 / (0.001129148 + (0.000234125 * temp) + (0.0000000876741 * temp * temp * temp));
-                _temperature[i]     = (int16_t)((kelvin - 273.15) * 10.0);
-            } else {
-                break;
+        if (_tempCount == 0) {
+            return;
+        }
+        _channel = 0;
+        _samples = 0;
+        _sum     = 0;
+        _discard = true;
+        ADMUX    = (1 << REFS0) | (_adcpin[0] & 0x07);                                    // AVcc reference
+        ADCSRA   = (1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);    // 125kHz ADC clock
+        ADCSRA |= (1 << ADSC);
+    }
+
+    // ADC conversion complete: oversample the current channel, then switch to the next one
+    // a completed scan goes to the back buffer, which then becomes the front buffer
+    void isr()
+    {
+        uint16_t adc = ADC;
+        if (_discard) {
+            _discard = false;    // first conversion after a channel switch, sample & hold not settled
+        } else {
+            _sum += adc;
+            if (++_samples >= NTC_OVERSAMPLING) {
+                _result[_back][_channel] = ((uint32_t)_sum << NTC_RESULT_SHIFT) / NTC_OVERSAMPLING;
+                _sum                     = 0;
+                _samples                 = 0;
+                if (++_channel >= _tempCount) {
+                    _channel = 0;
+                    _back ^= 1;
+                    _scanCount++;
+                }
+                ADMUX    = (1 << REFS0) | (_adcpin[_channel] & 0x07);
+                _discard = true;
+            }
+        }
+        ADCSRA |= (1 << ADSC);
+    }
+
+    // convert the front buffer, returns true if a new scan was completed since the last call
+    // the front buffer is copied with interrupts off: a late read could otherwise mix two scans after the next buffer swap
+    bool read()
+    {
+        uint16_t result[MAX_NTC];
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (_scanCount == _scanRead) {
+                return false;
+            }
+            _scanRead     = _scanCount;
+            uint8_t front = _back ^ 1;
+            for (uint8_t i = 0; i < _tempCount; i++) {
+                result[i] = _result[front][i];
             }
         }
+        for (uint8_t i = 0; i < _tempCount; i++) {
+            uint16_t adc16  = result[i];
+            bool     valid  = (adc16 >= NTC_VALID_MIN) && (adc16 <= NTC_VALID_MAX);
+            _temperature[i] = valid ? convert(_table[i], adc16) : TEMPERATURE_INVALID;
+        }
+        return true;
     }
 
+    // TEMPERATURE_INVALID for an open or shorted NTC
     int16_t temperature(uint8_t channel)
     {
         if (channel < _tempCount) {
             return _temperature[channel];
         }
-        return 0;
+        return TEMPERATURE_INVALID;
     }
 
 private:
-    int16_t _temperature[MAX_NTC];
-    uint8_t _adcpin[MAX_NTC];
-    uint8_t _tempCount;
+    int16_t           _temperature[MAX_NTC];
+    uint8_t           _adcpin[MAX_NTC];
+    const int16_t*    _table[MAX_NTC];
+    uint8_t           _tempCount;
+    volatile uint16_t _result[2][MAX_NTC];    // double buffer, ADC codes x16
+    volatile uint8_t  _back;                  // buffer written by the isr
+    volatile uint8_t  _scanCount;
+    uint8_t           _scanRead;
+    uint8_t           _channel;
+    uint8_t           _samples;
+    uint16_t          _sum;
+    bool              _discard;
+
+    // table lookup with linear interpolation, integer only
+    static int16_t convert(const int16_t* table, uint16_t adc16)
+    {
+        const uint8_t shift    = NTC_TABLE_SHIFT + NTC_RESULT_SHIFT;
+        uint8_t       index    = adc16 >> shift;
+        uint8_t       fraction = adc16 & ((1 << shift) - 1);
+        int16_t       t0       = pgm_read_word(&table[index]);
+        int16_t       t1       = pgm_read_word(&table[index + 1]);
+        return t0 + (int16_t)(((int32_t)(t1 - t0) * fraction + (1 << (shift - 1))) >> shift);
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
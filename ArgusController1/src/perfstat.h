@@ -0,0 +1,58 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// perfstat.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _PERFSTAT_H_
+#define _PERFSTAT_H_
+
+#define PERFSTAT_AVG_SHIFT 4    // moving average over about 2^PERFSTAT_AVG_SHIFT samples
+
+// max. and moving average of a time in us, values saturate at 65535us
+class PERFSTAT {
+
+public:
+    PERFSTAT()
+        : maxTime(0)
+        , avgTime(0)
+        , samples(false)
+    {
+    }
+
+    void add(unsigned long time_us)
+    {
+        uint16_t t = (time_us < 0xFFFF) ? time_us : 0xFFFF;
+        if (!samples) {
+            avgTime = (uint32_t)t << PERFSTAT_AVG_SHIFT;    // start the average with the first sample
+            samples = true;
+        }
+        avgTime = avgTime - (avgTime >> PERFSTAT_AVG_SHIFT) + t;
+        if (t > maxTime) {
+            maxTime = t;
+        }
+    }
+
+    uint16_t maximum() const { return maxTime; }
+
+    uint16_t average() const { return avgTime >> PERFSTAT_AVG_SHIFT; }
+
+    void reset()
+    {
+        maxTime = 0;
+        avgTime = 0;
+        samples = false;
+    }
+
+private:
+    uint16_t maxTime;
+    uint32_t avgTime;    // average << PERFSTAT_AVG_SHIFT
+    bool     samples;
+};
+
+#endif
@@ -0,0 +1,70 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// ringbuffer.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+// statically sized single producer / single consumer ring buffer
+// push() and pop() may be called from an interrupt and the main loop, one side each:
+// the producer only writes _head, the consumer only writes _tail, both are single byte (atomic) accesses
+template <class T, uint8_t SIZE> class RingBuffer {
+
+    static_assert((SIZE >= 2) && (SIZE <= 128) && ((SIZE & (SIZE - 1)) == 0), "RingBuffer SIZE must be a power of two <= 128");
+
+public:
+    RingBuffer()
+        : _head(0)
+        , _tail(0)
+    {
+    }
+
+    uint8_t count() const { return (uint8_t)(_head - _tail); }
+
+    uint8_t space() const { return SIZE - count(); }
+
+    bool push(const T& item)
+    {
+        if (count() >= SIZE) {
+            return false;    // item is dropped
+        }
+        _data[_head & (SIZE - 1)] = item;
+        _head                     = _head + 1;
+        return true;
+    }
+
+    T pop()
+    {
+        if (count() == 0) {
+            return T();
+        }
+        T item = _data[_tail & (SIZE - 1)];
+        _tail  = _tail + 1;
+        return item;
+    }
+
+    // item at position index from the front, without removing it
+    T peek(uint8_t index = 0) const
+    {
+        if (index >= count()) {
+            return T();
+        }
+        return _data[(uint8_t)(_tail + index) & (SIZE - 1)];
+    }
+
+    void clear() { _tail = _head; }
+
+private:
+    T                _data[SIZE];
+    volatile uint8_t _head;
+    volatile uint8_t _tail;
+};
+
+#endif
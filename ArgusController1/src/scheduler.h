@@ -0,0 +1,108 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// scheduler.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+
+#define SCHEDULER_IDLE_WINDOW 1000    // ms, window of the idle time statistics
+
+typedef void (*TaskHandler)();
+
+// entry of the task table in PROGMEM
+// period: ms between the runs of a periodic task (max. 32767), 0 = polled task, runs on every pass
+struct SchedulerTask {
+    TaskHandler handler;
+    uint16_t    period;
+};
+
+// static cooperative scheduler
+// every pass runs the polled tasks and the due periodic tasks in table order, then the MCU sleeps in idle mode
+// until the next interrupt: UART, pin change, ADC or at the latest the Timer0 overflow of millis() (1.024ms)
+// the first task is the deadline task, it runs before and after every other task, so its latency is bounded by
+// the longest run time of a single other task, not by the sum of all tasks
+// periodic tasks keep their phase: a late run does not delay the next ones, missed runs are skipped
+template <uint8_t COUNT> class SCHEDULER {
+
+    static_assert(COUNT >= 1, "SCHEDULER needs at least the deadline task");
+
+public:
+    SCHEDULER(const SchedulerTask* table)
+        : tasks(table)
+        , windowStart(0)
+        , sleepTime(0)
+        , idlePercent(0)
+    {
+    }
+
+    void begin()
+    {
+        uint16_t now = millis();
+        for (uint8_t i = 0; i < COUNT; i++) {
+            nextRun[i] = now;
+        }
+        windowStart = micros();
+        set_sleep_mode(SLEEP_MODE_IDLE);
+    }
+
+    // one pass over the task table
+    void run()
+    {
+        runTask(0);
+        for (uint8_t i = 1; i < COUNT; i++) {
+            uint16_t period = pgm_read_word(&tasks[i].period);
+            if (period > 0) {
+                uint16_t now = millis();
+                if ((int16_t)(now - nextRun[i]) < 0) {
+                    continue;    // not due
+                }
+                nextRun[i] += period;
+                if ((int16_t)(now - nextRun[i]) >= 0) {
+                    nextRun[i] = now + period;    // more than one period late
+                }
+            }
+            runTask(i);
+            runTask(0);
+        }
+    }
+
+    // idle sleep until the next interrupt
+    void sleep()
+    {
+        unsigned long start = micros();
+        sleep_enable();
+        sleep_cpu();
+        sleep_disable();
+        unsigned long now = micros();
+        sleepTime += now - start;
+        if ((now - windowStart) >= SCHEDULER_IDLE_WINDOW * 1000UL) {
+            idlePercent = sleepTime / ((now - windowStart) / 100);
+            windowStart = now;
+            sleepTime   = 0;
+        }
+    }
+
+    // % of the time spent sleeping in the last SCHEDULER_IDLE_WINDOW
+    uint8_t idle() const { return idlePercent; }
+
+private:
+    void runTask(uint8_t index) { ((TaskHandler)pgm_read_ptr(&tasks[index].handler))(); }
+
+    const SchedulerTask* tasks;
+    uint16_t             nextRun[COUNT];    // millis() of the next run of a periodic task
+    unsigned long        windowStart;       // us, start of the idle time window
+    unsigned long        sleepTime;         // us slept in the current window
+    uint8_t              idlePercent;
+};
+
+#endif
@@ -0,0 +1,255 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// tempsensors.h
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _TEMPSENSORS_H_
+#define _TEMPSENSORS_H_
+
+#include "ds18b20.h"
+#include "ntcsensor.h"
+
+#define TEMPSENSOR_DS18B20 0
+#define TEMPSENSOR_NTC 1
+#define TEMPSENSOR_FAKE 2
+
+// temperature channel descriptors, resolved at compile time
+// each descriptor is the backend of its channel: begin() sets the channel up, temperature() reads it,
+// read() polls it when the conversion of its DS18B20 bus is complete
+// index: number of the channel among the channels of its type, in channel order
+
+// DS18B20: sensor on a 1-wire pin, channels may share a pin, the sensors on a pin are assigned in 1-wire search order
+template <uint8_t PIN> struct Ds18b20Channel {
+    static_assert(PIN <= 19, "DS18B20 pin must be pin 0..19");
+
+    static const uint8_t type = TEMPSENSOR_DS18B20;
+    static const uint8_t pin  = PIN;
+
+    template <class S> static void begin(S& sensors, uint8_t channel) { sensors.beginDs18b20(channel, PIN); }
+
+    template <class S> static int16_t temperature(S& sensors, uint8_t index) { return sensors.ds18Sensor(index).temperature(); }
+
+    // reads the sensor if it is attached to the bus, true if it is lost after DS18B20_ERRORS_MAX read errors (it is detached then)
+    template <class S> static bool read(S& sensors, DS18B20BUS& bus, uint8_t index)
+    {
+        DS18B20& sensor = sensors.ds18Sensor(index);
+        if (!sensor.onBus(bus) || sensor.read() || (sensor.errors() < DS18B20_ERRORS_MAX)) {
+            return false;
+        }
+        sensor.detach();
+        return true;
+    }
+};
+
+// NTC: thermistor on an analog pin, thermistor types see ntcsensor.h
+template <uint8_t PIN, class NTC = NTC_10K_SH> struct NtcChannel {
+    static_assert((PIN >= A0) && (PIN <= A7), "NTC pin must be an analog pin A0..A7");
+
+    static const uint8_t type = TEMPSENSOR_NTC;
+    static const uint8_t pin  = PIN;
+
+    template <class S> static void begin(S& sensors, uint8_t) { sensors.ntc().addPin(PIN, NtcTable<NTC>::table); }
+
+    // the NTC channels are scanned in channel order, the index is the scan position
+    template <class S> static int16_t temperature(S& sensors, uint8_t index) { return sensors.ntc().temperature(index); }
+
+    template <class S> static bool read(S&, DS18B20BUS&, uint8_t) { return false; }    // scanned in the background
+};
+
+// fixed temperature x10, e.g. for tests without sensors
+template <int16_t TEMP> struct FakeChannel {
+    static const uint8_t type = TEMPSENSOR_FAKE;
+    static const uint8_t pin  = 0xFF;
+
+    template <class S> static void begin(S&, uint8_t) {}
+
+    template <class S> static int16_t temperature(S&, uint8_t) { return TEMP; }
+
+    template <class S> static bool read(S&, DS18B20BUS&, uint8_t) { return false; }
+};
+
+// number of descriptors of a sensor type
+template <uint8_t T> constexpr uint8_t tempChannelCount()
+{
+    return 0;
+}
+template <uint8_t T, class F, class... C> constexpr uint8_t tempChannelCount()
+{
+    return (F::type == T) + tempChannelCount<T, C...>();
+}
+
+// bit n set: descriptor n is of a sensor type, I: channel number of the first descriptor
+template <uint8_t T, uint8_t I> constexpr uint8_t tempChannelMask()
+{
+    return 0;
+}
+template <uint8_t T, uint8_t I, class F, class... C> constexpr uint8_t tempChannelMask()
+{
+    return ((F::type == T) ? (1 << I) : 0) | tempChannelMask<T, I + 1, C...>();
+}
+
+//---------------------------------------------------------
+// temperature channels of mixed sensor types, one descriptor per channel
+// backends without a channel cost no run time: their bus or ADC scan is never started
+template <class... CH> class TEMPSENSORS {
+
+public:
+    static const uint8_t count     = sizeof...(CH);
+    static const uint8_t ds18Count = tempChannelCount<TEMPSENSOR_DS18B20, CH...>();
+    static const uint8_t ntcCount  = tempChannelCount<TEMPSENSOR_NTC, CH...>();
+    static const uint8_t ds18Mask  = tempChannelMask<TEMPSENSOR_DS18B20, 0, CH...>();
+    static const uint8_t ntcMask   = tempChannelMask<TEMPSENSOR_NTC, 0, CH...>();
+
+    static_assert(count <= 8, "up to 8 temperature channels");
+    static_assert(ntcCount <= MAX_NTC, "too many NTC channels, see MAX_NTC");
+
+    TEMPSENSORS()
+        : _busCount(0)
+    {
+        memset(_busMask, 0, sizeof(_busMask));
+        memset(_busChannels, 0, sizeof(_busChannels));
+        memset(_channelBus, 0xFF, sizeof(_channelBus));
+    }
+
+    // busses of the DS18B20 channels and background ADC scan of the NTC channels
+    // the DS18B20 sensors are assigned by the sketch, see DS18B20 sensor assignment
+    void begin(uint16_t samplePeriod)
+    {
+        Channels<0, 0, 0, CH...>::begin(*this);
+        for (uint8_t bus = 0; bus < _busCount; bus++) {
+            _bus[bus].setSamplePeriod(samplePeriod);
+        }
+        _ntc.begin();
+    }
+
+    // TEMPSENSOR_x
+    static uint8_t type(uint8_t channel) { return Channels<0, 0, 0, CH...>::type(channel); }
+
+    // temperature x10, TEMPERATURE_INVALID without a valid value
+    int16_t temperature(uint8_t channel) { return Channels<0, 0, 0, CH...>::temperature(*this, channel); }
+
+    // temperatures of all channels, high byte first, 2 * count bytes
+    void encode(uint8_t* buf) { Channels<0, 0, 0, CH...>::encode(*this, buf); }
+
+    // bit n set: channel n has a valid temperature
+    uint8_t validMask() { return Channels<0, 0, 0, CH...>::validMask(*this); }
+
+    // reads the sensors of a DS18B20 bus once its conversion is complete, true with a new sample of the bus
+    // lost: bit n set if the sensor of channel n was detached after DS18B20_ERRORS_MAX read errors
+    // busses without attached sensors are not converted, the reads are unrolled over the DS18B20 descriptors
+    bool pollDs18b20(uint8_t bus, uint8_t& lost)
+    {
+        lost = 0;
+        if ((_bus[bus].count() == 0) || !_bus[bus].update()) {
+            return false;
+        }
+        lost = Channels<0, 0, 0, CH...>::read(*this, _bus[bus]);
+        return true;
+    }
+
+    // converts a completed background scan of the NTC channels, true with a new sample
+    bool pollNtc() { return (ntcCount > 0) && _ntc.read(); }
+
+    // DS18B20 of a DS18B20 channel, see ds18Mask
+    DS18B20& ds18b20(uint8_t channel) { return _ds18[Channels<0, 0, 0, CH...>::ds18Index(channel)]; }
+
+    // DS18B20 by its number among the DS18B20 channels
+    DS18B20& ds18Sensor(uint8_t index) { return _ds18[index]; }
+
+    DS18B20BUS& bus(uint8_t index) { return _bus[index]; }
+
+    // one bus per pin with DS18B20 channels
+    uint8_t busCount() const { return _busCount; }
+
+    // bit n set: channel n is on the bus
+    uint8_t busMask(uint8_t bus) const { return _busMask[bus]; }
+
+    // number of channels on the bus, more than the attached sensors: a sensor is missing
+    uint8_t busChannels(uint8_t bus) const { return _busChannels[bus]; }
+
+    // bus of a DS18B20 channel, 0xFF on channels of other types
+    uint8_t channelBus(uint8_t channel) const { return (channel < count) ? _channelBus[channel] : 0xFF; }
+
+    NTCSENSOR& ntc() { return _ntc; }
+
+    // DS18B20 channel on a pin, the first channel on a pin starts its bus
+    void beginDs18b20(uint8_t channel, uint8_t pin)
+    {
+        uint8_t bus = 0;
+        while ((bus < _busCount) && (_bus[bus].pin() != pin)) {
+            bus++;
+        }
+        if (bus == _busCount) {
+            _bus[bus].begin(pin);
+            _busCount++;
+        }
+        _channelBus[channel] = bus;
+        _busMask[bus] |= 1 << channel;
+        _busChannels[bus]++;
+    }
+
+private:
+    DS18B20BUS _bus[(ds18Count > 0) ? ds18Count : 1];
+    uint8_t    _busMask[(ds18Count > 0) ? ds18Count : 1];
+    uint8_t    _busChannels[(ds18Count > 0) ? ds18Count : 1];
+    uint8_t    _busCount;
+    DS18B20    _ds18[(ds18Count > 0) ? ds18Count : 1];
+    uint8_t    _channelBus[count];
+    NTCSENSOR  _ntc;
+
+    // channel descriptor list, I: channel number of the first descriptor, N, D: its number among the NTC and DS18B20 channels
+    // runtime channel numbers are dispatched to the descriptors, the compiler unrolls the recursion
+    template <uint8_t I, uint8_t N, uint8_t D, class... C> struct Channels {
+        static void    begin(TEMPSENSORS&) {}
+        static uint8_t type(uint8_t) { return 0xFF; }
+        static int16_t temperature(TEMPSENSORS&, uint8_t) { return TEMPERATURE_INVALID; }
+        static void    encode(TEMPSENSORS&, uint8_t*) {}
+        static uint8_t validMask(TEMPSENSORS&) { return 0; }
+        static uint8_t read(TEMPSENSORS&, DS18B20BUS&) { return 0; }
+        static uint8_t ds18Index(uint8_t) { return 0; }
+    };
+
+    template <uint8_t I, uint8_t N, uint8_t D, class F, class... C> struct Channels<I, N, D, F, C...> {
+        typedef Channels<I + 1, N + (F::type == TEMPSENSOR_NTC), D + (F::type == TEMPSENSOR_DS18B20), C...> Next;
+
+        static const uint8_t index = (F::type == TEMPSENSOR_NTC) ? N : D;    // number among the channels of its type
+
+        static void begin(TEMPSENSORS& sensors)
+        {
+            F::begin(sensors, I);
+            Next::begin(sensors);
+        }
+
+        static uint8_t type(uint8_t channel) { return (channel == I) ? F::type : Next::type(channel); }
+
+        static int16_t temperature(TEMPSENSORS& sensors, uint8_t channel)
+        {
+            return (channel == I) ? F::temperature(sensors, index) : Next::temperature(sensors, channel);
+        }
+
+        static void encode(TEMPSENSORS& sensors, uint8_t* buf)
+        {
+            int16_t temperature = F::temperature(sensors, index);
+            buf[2 * I]          = temperature >> 8;
+            buf[2 * I + 1]      = temperature & 0xFF;
+            Next::encode(sensors, buf);
+        }
+
+        static uint8_t validMask(TEMPSENSORS& sensors)
+        {
+            return ((F::temperature(sensors, index) != TEMPERATURE_INVALID) ? (1 << I) : 0) | Next::validMask(sensors);
+        }
+
+        static uint8_t read(TEMPSENSORS& sensors, DS18B20BUS& bus) { return (F::read(sensors, bus, index) ? (1 << I) : 0) | Next::read(sensors, bus); }
+
+        static uint8_t ds18Index(uint8_t channel) { return ((channel == I) && (F::type == TEMPSENSOR_DS18B20)) ? D : Next::ds18Index(channel); }
+    };
+};
+
+#endif
@@ -0,0 +1,56 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// EEPROM.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SIM_EEPROM_H_
+#define _SIM_EEPROM_H_
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <stdint.h>
+
+uint8_t simEepromRead(uint16_t addr);
+void    simEepromWrite(uint16_t addr, uint8_t value);    // waits for a previous write, then starts the write
+
+// Arduino EEPROM library interface, file backed, see sim.cpp
+struct EEPROMClass {
+    uint8_t  read(int idx) { return simEepromRead(idx); }
+    void     write(int idx, uint8_t val) { simEepromWrite(idx, val); }
+    uint16_t length() { return E2END + 1; }
+
+    void update(int idx, uint8_t val)
+    {
+        if (read(idx) != val) {
+            write(idx, val);
+        }
+    }
+
+    template <typename T> T& get(int idx, T& t)
+    {
+        uint8_t* ptr = (uint8_t*)&t;
+        for (uint16_t i = 0; i < sizeof(T); i++) {
+            ptr[i] = read(idx + i);
+        }
+        return t;
+    }
+
+    template <typename T> const T& put(int idx, const T& t)
+    {
+        const uint8_t* ptr = (const uint8_t*)&t;
+        for (uint16_t i = 0; i < sizeof(T); i++) {
+            update(idx + i, ptr[i]);
+        }
+        return t;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,72 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// OneWire.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+// Interface of the OneWire library, the bus transactions are decoded at
+// byte level and answered by the DS18B20 models in sim.cpp
+//---------------------------------------------------------
+
+#ifndef _SIM_ONEWIRE_H_
+#define _SIM_ONEWIRE_H_
+
+#include <stdint.h>
+
+class OneWire {
+
+public:
+    OneWire()
+        : _pin(0xFF)
+        , _state(StateIdle)
+        , _selected(0)
+        , _count(0)
+    {
+        reset_search();
+    }
+    OneWire(uint8_t pin)
+        : _pin(pin)
+        , _state(StateIdle)
+        , _selected(0)
+        , _count(0)
+    {
+        reset_search();
+    }
+
+    void begin(uint8_t pin) { _pin = pin; }
+
+    uint8_t reset();
+    void    select(const uint8_t rom[8]);
+    void    skip();
+    void    write(uint8_t v, uint8_t power = 0);
+    void    write_bytes(const uint8_t* buf, uint16_t count, bool power = 0);
+    uint8_t read();
+    void    read_bytes(uint8_t* buf, uint16_t count);
+    void    write_bit(uint8_t v);
+    uint8_t read_bit();
+    void    depower() {}
+    void    reset_search();
+    void    target_search(uint8_t family_code);
+    bool    search(uint8_t* newAddr, bool search_mode = true);
+
+    static uint8_t crc8(const uint8_t* addr, uint8_t len);
+
+private:
+    enum State : uint8_t { StateRom, StateMatch, StateFunction, StateWrite, StateRead, StateIdle };
+
+    uint8_t  _pin;
+    State    _state;
+    uint32_t _selected;    // bit n: sensor model n is selected
+    uint8_t  _count;       // bytes of the current ROM or function command
+    uint8_t  _rom[8];
+    uint8_t  _data[9];
+    uint8_t  _searchLast[8];
+    bool     _searchDone;
+    uint8_t  _searchFamily;
+};
+
+#endif
@@ -0,0 +1,20 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// avr/eeprom.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+#include <avr/io.h>
+
+// EEPE is set by the EEPROM model while a write is in progress
+#define eeprom_is_ready() (!(EECR & (1 << EEPE)))
+
+#endif
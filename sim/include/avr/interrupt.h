@@ -0,0 +1,30 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// avr/interrupt.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+// interrupt handlers are plain functions, called by the simulation while the I flag in SREG is set
+#define ISR(vector, ...) extern "C" void vector(void)
+
+inline void sei()
+{
+    SREG |= 1 << SREG_I;
+}
+
+inline void cli()
+{
+    SREG &= ~(1 << SREG_I);
+}
+
+#endif
@@ -0,0 +1,137 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// avr/io.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+// ATmega328P registers used by the firmware, plain variables read and
+// written by the hardware models in sim.cpp
+//---------------------------------------------------------
+
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define F_CPU 16000000UL
+#define E2END 0x3FF
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t MCUSR;
+
+// ports
+extern volatile uint8_t PINB, PORTB, DDRB;
+extern volatile uint8_t PINC, PORTC, DDRC;
+extern volatile uint8_t PIND, PORTD, DDRD;
+
+// pin change interrupts
+extern volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+// Timer1
+extern volatile uint8_t  TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t OCR1A, OCR1B, ICR1, TCNT1;
+
+// Timer2
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2, TCNT2;
+
+// ADC
+extern volatile uint8_t  ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+
+// EEPROM
+extern volatile uint8_t  EECR, EEDR;
+extern volatile uint16_t EEAR;
+
+// UART
+extern volatile uint8_t UCSR0A;
+
+// sleep mode control
+extern volatile uint8_t SMCR;
+
+// SREG
+#define SREG_I 7
+
+// MCUSR
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+// PCICR
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+
+// TCCR1A, TCCR1B
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+
+// TCCR2A, TCCR2B
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+
+// ADMUX, ADCSRA
+#define MUX0 0
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+
+// EECR
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+
+// UCSR0A
+#define MPCM0 0
+#define U2X0 1
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+
+// SMCR
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+
+// interrupt vectors
+#define INT0_vect __vector_1
+#define INT1_vect __vector_2
+#define PCINT0_vect __vector_3
+#define PCINT1_vect __vector_4
+#define PCINT2_vect __vector_5
+#define WDT_vect __vector_6
+#define ADC_vect __vector_21
+#define EE_READY_vect __vector_22
+
+#endif
@@ -0,0 +1,39 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// util/atomic.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+// same construction as avr-libc: SREG is saved, interrupts are disabled and SREG is restored on leaving the block
+static inline uint8_t __iCliRetVal()
+{
+    cli();
+    return 1;
+}
+
+static inline void __iSeiParam(const uint8_t* __s)
+{
+    (void)__s;
+    sei();
+}
+
+static inline void __iRestore(const uint8_t* __s)
+{
+    SREG = *__s;
+}
+
+#define ATOMIC_BLOCK(type) for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
+
+#endif
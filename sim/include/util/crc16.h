@@ -0,0 +1,31 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// util/crc16.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+#ifndef _SIM_UTIL_CRC16_H_
+#define _SIM_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+// Dallas/Maxim CRC8, polynomial x^8 + x^5 + x^4 + 1
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data)
+{
+    crc = crc ^ data;
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 0x01) {
+            crc = (crc >> 1) ^ 0x8C;
+        } else {
+            crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+#endif
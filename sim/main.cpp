@@ -0,0 +1,517 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// main.cpp - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+// Runs the sketch on the virtual clock with a scripted host or a pty
+//
+// argus_sim [options]
+//   --script <file>     host script, see scripts/smoke.txt
+//   --pty               serial port as pseudo terminal, real time, e.g. for Argus Monitor via socat
+//   --duration <s>      simulated time, default 10s (script: until 'end')
+//   --eeprom <file>     EEPROM image, created if missing, default: erased, not saved
+//   --fan <out:tach[:maxrpm[:pulses[:inv]]]>   fan model, default 0:2:2000:2:1 and 1:3:2000:2:1
+//   --ds18b20 <pin>     DS18B20 model, default one on each of A0..A3 (14..17)
+//   --ntc <ch>          NTC model on ADC channel, default channels 0..3
+//   --loop-time <us>    CPU time of one loop() pass besides the modelled I/O, default 20
+//   --quiet             no frame log, statistics only
+//
+// exit code 2: crc errors, watchdog timeouts or failed expectations of the script
+//---------------------------------------------------------
+
+// clang-format off
+#include <algorithm>
+#include <string>
+#include <vector>
+// clang-format on
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include <Arduino.h>
+#include <util/crc16.h>
+
+void setup();
+void loop();
+
+namespace {
+
+struct ScriptLine {
+    uint64_t    time;    // us
+    std::string cmd;
+    std::string args;
+};
+
+std::vector<ScriptLine> script;
+size_t                  scriptPos;
+bool                    quiet;
+int                     ptyFd = -1;
+
+// expected device frames of the script, bytes without crc8, -1 = any byte
+std::vector<std::vector<int>> expects;
+size_t                        expectPos;
+bool                          expectNone;    // no answer until the next script line
+uint32_t                      expectFailures;
+
+// host frame timing, latency = last byte of a host frame to last byte of the answer
+uint64_t hostFrameEnd;
+bool     answerPending;
+uint32_t latencyCount;
+uint64_t latencySum;
+uint32_t latencyMin = UINT32_MAX;
+uint32_t latencyMax;
+uint32_t frameCount;
+uint32_t crcErrors;
+
+// device frame parser
+uint8_t     rxFrame[256];
+uint16_t    rxLen;
+std::string rxText;
+
+uint8_t crc8(const uint8_t* data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = _crc_ibutton_update(crc, data[i]);
+    }
+    return crc;
+}
+
+void logTime()
+{
+    printf("[%10.3f ms] ", sim::now() / 1000.0);
+}
+
+void flushText()
+{
+    if (!rxText.empty()) {
+        if (!quiet) {
+            logTime();
+            printf("dbg  %s\n", rxText.c_str());
+        }
+        rxText.clear();
+    }
+}
+
+void printFrame(const char* prefix, const uint8_t* data, size_t len)
+{
+    logTime();
+    printf("%s", prefix);
+    for (size_t i = 0; i < len; i++) {
+        printf(" %02X", data[i]);
+    }
+    printf("\n");
+}
+
+void printPattern(const char* prefix, const std::vector<int>& pattern)
+{
+    logTime();
+    printf("%s", prefix);
+    for (int b : pattern) {
+        printf((b < 0) ? " xx" : " %02X", b);
+    }
+    printf("\n");
+}
+
+bool frameMatches(const std::vector<int>& pattern)
+{
+    if (pattern.size() != (size_t)(rxLen - 1)) {
+        return false;
+    }
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if ((pattern[i] >= 0) && (pattern[i] != rxFrame[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the next answer must match the first pending expectation, Telemetry frames only if one is expected
+void checkExpect(uint8_t cmd)
+{
+    if (expectNone && (cmd != 0x52)) {
+        expectFailures++;
+        printFrame("expect failed, no answer expected:", rxFrame, rxLen);
+        return;
+    }
+    if (expectPos >= expects.size()) {
+        return;
+    }
+    const std::vector<int>& pattern = expects[expectPos];
+    bool telemetry = (pattern.size() > 3) && (pattern[(pattern[0] == 0xC6) ? 3 : 2] == 0x52);
+    if ((cmd == 0x52) && !telemetry) {
+        return;
+    }
+    expectPos++;
+    if (!frameMatches(pattern)) {
+        expectFailures++;
+        printPattern("expect failed, expected:", pattern);
+        printFrame("               received:", rxFrame, rxLen);
+    }
+}
+
+void deviceFrame()
+{
+    frameCount++;
+    bool crcOk = crc8(rxFrame, rxLen - 1) == rxFrame[rxLen - 1];
+    if (!crcOk) {
+        crcErrors++;
+    }
+    uint8_t cmd    = (rxFrame[0] == 0xC6) ? rxFrame[3] : rxFrame[2];    // addressed frames: C6 byteCnt address cmd ..
+    bool    answer = answerPending && (cmd != 0x52);                     // Telemetry frames are unsolicited
+
+    // an answer before the end of the last host frame belongs to an earlier, pipelined frame: no latency
+    answer = answer && (sim::now() >= hostFrameEnd);
+    if (answer) {
+        uint32_t latency = sim::now() - hostFrameEnd;
+        answerPending    = false;
+        latencyCount++;
+        latencySum += latency;
+        latencyMin = min(latencyMin, latency);
+        latencyMax = max(latencyMax, latency);
+    }
+    if (!quiet) {
+        logTime();
+        printf("dev ");
+        for (uint16_t i = 0; i < rxLen; i++) {
+            printf(" %02X", rxFrame[i]);
+        }
+        if (!crcOk) {
+            printf("  crc error");
+        }
+        if (answer) {
+            printf("  (%.3f ms)", (sim::now() - hostFrameEnd) / 1000.0);
+        }
+        printf("\n");
+    }
+    checkExpect(cmd);
+}
+
+// device to host bytes: C5/C6 frames, everything else is debug output
+void deviceByte(uint8_t data)
+{
+    if (ptyFd >= 0) {
+        ssize_t n = write(ptyFd, &data, 1);
+        (void)n;
+    }
+    if ((rxLen == 0) && (data != 0xC5) && (data != 0xC6)) {
+        if (data == '\n') {
+            flushText();
+        } else if (data != '\r') {
+            rxText += (char)data;
+        }
+        return;
+    }
+    flushText();
+    rxFrame[rxLen++] = data;
+    if ((rxLen >= 2) && (rxLen == rxFrame[1] + 2)) {
+        deviceFrame();
+        rxLen = 0;
+    }
+}
+
+void hostSend(const std::vector<uint8_t>& data)
+{
+    if (data.empty()) {
+        return;
+    }
+    hostFrameEnd  = sim::hostWrite(data.data(), data.size());
+    answerPending = true;
+    if (!quiet) {
+        logTime();
+        printf("host");
+        for (uint8_t b : data) {
+            printf(" %02X", b);
+        }
+        printf("\n");
+    }
+}
+
+// hex bytes up to a comment, xx = any byte
+std::vector<int> parsePattern(const std::string& text)
+{
+    std::vector<int> pattern;
+    char             token[8];
+    int              n;
+    const char*      p = text.c_str();
+    while ((sscanf(p, "%7s%n", token, &n) == 1) && (token[0] != '#')) {
+        pattern.push_back((strcmp(token, "xx") == 0) ? -1 : (int)strtoul(token, NULL, 16));
+        p += n;
+    }
+    return pattern;
+}
+
+std::vector<uint8_t> parseHex(const std::string& text)
+{
+    std::vector<uint8_t> data;
+    const char*          p = text.c_str();
+    char*                end;
+    while (true) {
+        unsigned long v = strtoul(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        data.push_back(v);
+        p = end;
+    }
+    return data;
+}
+
+bool loadScript(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char*  p    = line;
+        double time = strtod(p, &p);
+        while ((*p == ' ') || (*p == '\t')) {
+            p++;
+        }
+        if ((p == line) || (*p == '#') || (*p == '\n') || (*p == '\0')) {
+            continue;    // comment or empty line
+        }
+        std::string text(p);
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        size_t      space = text.find(' ');
+        ScriptLine  s;
+        s.time = (uint64_t)(time * 1000000.0);
+        s.cmd  = text.substr(0, space);
+        s.args = (space == std::string::npos) ? "" : text.substr(space + 1);
+        script.push_back(s);
+    }
+    fclose(f);
+    std::stable_sort(script.begin(), script.end(), [](const ScriptLine& a, const ScriptLine& b) { return a.time < b.time; });
+    return true;
+}
+
+void printState()
+{
+    logTime();
+    printf("fans");
+    for (uint8_t i = 0; i < sim::fanCount(); i++) {
+        printf("  %u: %.0f%% %u rpm", i, sim::fanDuty(i) * 100.0f, sim::fanRpm(i));
+    }
+    printf("\n");
+}
+
+// returns false at the end of the script
+bool runScript()
+{
+    while ((scriptPos < script.size()) && (script[scriptPos].time <= sim::now())) {
+        const ScriptLine& s = script[scriptPos++];
+        unsigned          n = 0;
+        float             value;
+        char              state[8];
+        expectNone = false;
+        if (s.cmd == "frame") {    // host frame, crc is appended
+            std::vector<uint8_t> data = parseHex(s.args);
+            data.push_back(crc8(data.data(), data.size()));
+            hostSend(data);
+        } else if (s.cmd == "raw") {
+            hostSend(parseHex(s.args));
+        } else if ((s.cmd == "temp") && (sscanf(s.args.c_str(), "%u %f", &n, &value) == 2)) {
+            sim::setTemperature(n, value);
+        } else if ((s.cmd == "sensor") && (sscanf(s.args.c_str(), "%u %7s", &n, state) == 2)) {
+            sim::setConnected(n, strcmp(state, "off") != 0);
+        } else if ((s.cmd == "fan") && (sscanf(s.args.c_str(), "%u %f", &n, &value) == 2)) {
+            sim::setFanMaxRpm(n, value);
+        } else if ((s.cmd == "baud") && (sscanf(s.args.c_str(), "%u", &n) == 1)) {
+            sim::setHostBaud(n);
+        } else if (s.cmd == "expect") {    // next answer, crc is checked separately
+            expects.push_back(parsePattern(s.args));
+        } else if (s.cmd == "expect-none") {
+            expectNone = true;
+        } else if (s.cmd == "print") {
+            printState();
+        } else if (s.cmd == "end") {
+            return false;
+        } else {
+            fprintf(stderr, "script: unknown command '%s %s'\n", s.cmd.c_str(), s.args.c_str());
+        }
+    }
+    return true;
+}
+
+bool openPty()
+{
+    ptyFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((ptyFd < 0) || (grantpt(ptyFd) != 0) || (unlockpt(ptyFd) != 0)) {
+        perror("pty");
+        return false;
+    }
+    struct termios tio;
+    tcgetattr(ptyFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(ptyFd, TCSANOW, &tio);
+    fcntl(ptyFd, F_SETFL, O_NONBLOCK);
+    printf("serial port: %s\n", ptsname(ptyFd));
+    fflush(stdout);
+    return true;
+}
+
+uint64_t wallClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// pty mode: host bytes from the pty, virtual time follows the wall clock
+void runPty(uint64_t start)
+{
+    uint8_t buf[64];
+    ssize_t n = read(ptyFd, buf, sizeof(buf));
+    if (n > 0) {
+        hostSend(std::vector<uint8_t>(buf, buf + n));
+    }
+    uint64_t wall = wallClock() - start;
+    if (sim::now() > wall + 1000) {
+        usleep(sim::now() - wall);
+    }
+}
+
+bool parseFan(const char* arg)
+{
+    unsigned v[5] = { 0, 0, 2000, 2, 1 };
+    int      n    = sscanf(arg, "%u:%u:%u:%u:%u", &v[0], &v[1], &v[2], &v[3], &v[4]);
+    if ((n < 2) || (v[0] > 2)) {
+        fprintf(stderr, "--fan out:tach[:maxrpm[:pulses[:inv]]], out 0 = OC1A, 1 = OC1B, 2 = OC2B\n");
+        return false;
+    }
+    sim::addFan(v[0], v[1], v[2], v[3], v[4] != 0);
+    return true;
+}
+
+}
+
+//---------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    double      duration = -1.0;
+    uint32_t    loopTime = 20;
+    const char* eeprom   = NULL;
+    bool        pty      = false;
+    bool        fans     = false;
+    bool        sensors  = false;
+    bool        ntc      = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg  = argv[i];
+        const char* next = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if ((arg == "--pty") || (arg == "--quiet")) {
+            pty   = pty || (arg == "--pty");
+            quiet = quiet || (arg == "--quiet");
+        } else if (!next) {
+            fprintf(stderr, "usage: argus_sim [--script file] [--pty] [--duration s] [--eeprom file] [--fan out:tach[:maxrpm[:pulses[:inv]]]] [--ds18b20 pin] [--ntc ch] [--loop-time us] [--quiet]\n");
+            return 1;
+        } else {
+            i++;
+            if (arg == "--script") {
+                if (!loadScript(next)) {
+                    return 1;
+                }
+            } else if (arg == "--duration") {
+                duration = atof(next);
+            } else if (arg == "--eeprom") {
+                eeprom = next;
+            } else if (arg == "--fan") {
+                if (!parseFan(next)) {
+                    return 1;
+                }
+                fans = true;
+            } else if (arg == "--ds18b20") {
+                sim::addDs18b20(atoi(next));
+                sensors = true;
+            } else if (arg == "--ntc") {
+                sim::addNtc(atoi(next));
+                ntc = true;
+            } else if (arg == "--loop-time") {
+                loopTime = atoi(next);
+            } else {
+                fprintf(stderr, "unknown option %s\n", arg.c_str());
+                return 1;
+            }
+        }
+    }
+
+    // default hardware: the example circuit of the sketch
+    if (!fans) {
+        sim::addFan(0, 2, 2000, 2, true);
+        sim::addFan(1, 3, 2000, 2, true);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        if (!sensors) {
+            sim::addDs18b20(A0 + i);
+        }
+        if (!ntc) {
+            sim::addNtc(i);
+        }
+        sim::setTemperature(i, 25.0f + i);
+    }
+    if (!sim::eepromLoad(eeprom) && eeprom) {
+        fprintf(stderr, "cannot open %s\n", eeprom);
+    }
+    if (pty && !openPty()) {
+        return 1;
+    }
+    if (duration < 0.0) {
+        duration = (script.empty() || pty) ? 10.0 : 1e9;
+    }
+    sim::setTxHandler(deviceByte);
+
+    // Arduino core main()
+    sei();
+    setup();
+    uint64_t start   = wallClock();
+    uint64_t end     = sim::now() + (uint64_t)(duration * 1000000.0);
+    uint64_t loops   = 0;
+    uint64_t maxLoop = 0;
+    uint64_t loopSum = 0;
+    while (sim::now() < end) {
+        if (!runScript()) {
+            break;
+        }
+        if (pty) {
+            runPty(start);
+        }
+        uint64_t t = sim::now();
+        loop();
+        sim::advance(loopTime);
+        uint64_t dt = sim::now() - t;
+        loopSum += dt;
+        maxLoop = max(maxLoop, dt);
+        loops++;
+    }
+    flushText();
+
+    printf("simulated %.3f s, %llu loop() passes, avg %.1f us, max %.3f ms, sleeping %.1f%%\n", sim::now() / 1000000.0,
+           (unsigned long long)loops, loops ? (double)loopSum / loops : 0.0, maxLoop / 1000.0,
+           sim::now() ? 100.0 * sim::sleepTime() / sim::now() : 0.0);
+    printf("device frames %u, crc errors %u\n", frameCount, crcErrors);
+    if (latencyCount > 0) {
+        printf("answer latency min %.3f ms, avg %.3f ms, max %.3f ms (%u answers)\n", latencyMin / 1000.0, latencySum / 1000.0 / latencyCount,
+               latencyMax / 1000.0, latencyCount);
+    }
+    printf("watchdog timeouts %u\n", sim::watchdogTimeouts());
+    for (; expectPos < expects.size(); expectPos++) {
+        expectFailures++;
+        printPattern("expect failed, no answer:", expects[expectPos]);
+    }
+    if (!expects.empty() || (expectFailures > 0)) {
+        printf("expect failures %u\n", expectFailures);
+    }
+    return ((crcErrors > 0) || (sim::watchdogTimeouts() > 0) || (expectFailures > 0)) ? 2 : 0;
+}
@@ -0,0 +1,16 @@
+#---------------------------------------------------------
+# Argus Controller (Open Hardware)
+# runtest.cmake - runs simulation scripts on a fresh EEPROM image
+#
+# cmake -DSIM=<argus_sim> -DSCRIPTS=<script>[,<script>..] -DEEPROM=<image> -P runtest.cmake
+#---------------------------------------------------------
+
+# the scripts run one after the other on the same image, e.g. a second run checks the values stored by the first one
+file(REMOVE ${EEPROM})
+string(REPLACE "," ";" SCRIPTS "${SCRIPTS}")
+foreach(SCRIPT IN LISTS SCRIPTS)
+    execute_process(COMMAND ${SIM} --script ${SCRIPT} --eeprom ${EEPROM} --quiet RESULT_VARIABLE RESULT)
+    if(NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${SCRIPT} failed: ${RESULT}")
+    endif()
+endforeach()
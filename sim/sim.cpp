@@ -0,0 +1,1099 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// sim.cpp - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+
+// clang-format off
+#include <deque>
+#include <vector>
+// clang-format on
+#include <stdio.h>
+
+#include "sim.h"
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <OneWire.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+
+//---------------------------------------------------------
+// registers
+
+volatile uint8_t SREG;
+volatile uint8_t MCUSR = 1 << PORF;
+
+volatile uint8_t PINB, PORTB, DDRB;
+volatile uint8_t PINC, PORTC, DDRC;
+volatile uint8_t PIND, PORTD, DDRD;
+
+volatile uint8_t PCICR, PCIFR, PCMSK0, PCMSK1, PCMSK2;
+
+volatile uint8_t  TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t OCR1A, OCR1B, ICR1, TCNT1;
+
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, OCR2B, TIMSK2, TIFR2, TCNT2;
+
+volatile uint8_t  ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+
+volatile uint8_t  EECR, EEDR;
+volatile uint16_t EEAR;
+
+volatile uint8_t UCSR0A = 1 << UDRE0;
+
+volatile uint8_t SMCR;
+
+HardwareSerial Serial;
+EEPROMClass    EEPROM;
+
+// interrupt handlers of the sketch, vectors without ISR() are null
+extern "C" {
+void INT0_vect(void) __attribute__((weak));
+void INT1_vect(void) __attribute__((weak));
+void PCINT0_vect(void) __attribute__((weak));
+void PCINT1_vect(void) __attribute__((weak));
+void PCINT2_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+}
+
+namespace {
+
+#define UART_BUFFER_SIZE 64     // SERIAL_RX_BUFFER_SIZE, SERIAL_TX_BUFFER_SIZE of the Arduino core
+#define EEPROM_WRITE_TIME 3400  // us, erase and write
+#define ONEWIRE_RESET_TIME 960  // us, reset pulse and presence detect
+#define ONEWIRE_SLOT_TIME 65    // us, one read or write slot
+#define ADC_CYCLES 13           // ADC clocks per conversion
+#define FAN_TIME_CONSTANT 1.0f  // s, fan speed response to a pwm change
+#define FAN_MIN_RPM 60          // below, the tach output stays high
+#define FAN_IDLE_POLL 10000     // us, pwm poll period of a stopped fan
+#define TIMER0_OVF_TIME 1024    // us, Timer0 overflow interrupt of millis(), wakes the CPU from idle sleep
+
+uint64_t clockUs;
+bool     busy;       // models are running or an interrupt handler is active: time only
+uint64_t sleepUs;    // time in sleep_cpu()
+
+//---------------------------------------------------------
+// pins and external interrupts
+
+void (*intHandler[2])(void);
+int  intMode[2];
+bool intFlag[2];
+
+volatile uint8_t* pinRegister(uint8_t pin)
+{
+    return (pin <= 7) ? &PIND : ((pin <= 13) ? &PINB : &PINC);
+}
+
+volatile uint8_t* portRegister(uint8_t pin)
+{
+    return (pin <= 7) ? &PORTD : ((pin <= 13) ? &PORTB : &PORTC);
+}
+
+volatile uint8_t* ddrRegister(uint8_t pin)
+{
+    return (pin <= 7) ? &DDRD : ((pin <= 13) ? &DDRB : &DDRC);
+}
+
+uint8_t pinMask(uint8_t pin)
+{
+    return 1 << digitalPinToPCMSKbit(pin);
+}
+
+// input level change by a model or an output, sets the external and pin change interrupt flags
+void setPinLevel(uint8_t pin, bool level)
+{
+    volatile uint8_t* reg = pinRegister(pin);
+    bool              old = (*reg & pinMask(pin)) != 0;
+    if (old == level) {
+        return;
+    }
+    if (level) {
+        *reg |= pinMask(pin);
+    } else {
+        *reg &= ~pinMask(pin);
+    }
+
+    int irq = digitalPinToInterrupt(pin);
+    if ((irq >= 0) && intHandler[irq]) {
+        if ((intMode[irq] == CHANGE) || ((intMode[irq] == FALLING) && !level) || ((intMode[irq] == RISING) && level)) {
+            intFlag[irq] = true;
+        }
+    }
+    if (*digitalPinToPCMSK(pin) & pinMask(pin)) {
+        PCIFR |= 1 << digitalPinToPCICRbit(pin);
+    }
+}
+
+//---------------------------------------------------------
+// UART
+
+struct RxByte {
+    uint64_t time;    // arrival of the stop bit
+    uint8_t  data;
+    uint32_t baud;    // baud rate of the host, 0 = the baud rate of the device
+};
+
+uint32_t           uartBaud     = 0;
+uint32_t           uartHostBaud = 0;    // 0 = follows the device
+std::deque<RxByte> uartHostQueue;    // bytes on the wire
+uint64_t           uartHostLast;     // arrival of the last queued byte
+std::deque<uint8_t> uartRx;
+std::deque<uint8_t> uartTx;
+bool               uartTxBusy;
+uint8_t            uartTxByte;
+uint64_t           uartTxDone;
+sim::TxHandler     uartTxHandler;
+
+uint32_t uartByteTime(uint32_t baud = 0)
+{
+    baud = (baud > 0) ? baud : ((uartBaud > 0) ? uartBaud : 57600);
+    return (10000000UL + baud / 2) / baud;
+}
+
+// host and device at different baud rates: the bytes are lost, framing errors are not modelled
+bool uartMismatch(uint32_t hostBaud)
+{
+    return (hostBaud > 0) && (hostBaud != ((uartBaud > 0) ? uartBaud : 57600));
+}
+
+void uartRun()
+{
+    while (!uartHostQueue.empty() && (uartHostQueue.front().time <= clockUs)) {
+        if (uartMismatch(uartHostQueue.front().baud)) {
+            // the byte is lost
+        } else if (uartRx.size() < UART_BUFFER_SIZE - 1) {
+            uartRx.push_back(uartHostQueue.front().data);
+        }    // else: overrun, the byte is lost
+        uartHostQueue.pop_front();
+    }
+    while (uartTxBusy && (uartTxDone <= clockUs)) {
+        if (uartTxHandler && !uartMismatch(uartHostBaud)) {
+            uartTxHandler(uartTxByte);
+        }
+        uartTxBusy = !uartTx.empty();
+        if (!uartTxBusy) {
+            UCSR0A |= 1 << TXC0;    // last stop bit sent
+        }
+        if (uartTxBusy) {
+            uartTxByte = uartTx.front();
+            uartTx.pop_front();
+            uartTxDone += uartByteTime();
+        }
+    }
+}
+
+//---------------------------------------------------------
+// EEPROM
+
+uint8_t  eepromData[E2END + 1];
+FILE*    eepromFile;
+uint64_t eepromBusyUntil;
+
+void eepromWait()
+{
+    if (clockUs < eepromBusyUntil) {
+        sim::advance(eepromBusyUntil - clockUs);
+    }
+}
+
+void eepromRun()
+{
+    if (clockUs >= eepromBusyUntil) {
+        EECR &= ~(1 << EEPE);
+    }
+}
+
+//---------------------------------------------------------
+// watchdog
+
+uint32_t wdtTimeout;    // us, 0 = off
+uint64_t wdtDeadline;
+uint32_t wdtCount;
+
+void wdtRun()
+{
+    if ((wdtTimeout > 0) && (clockUs > wdtDeadline)) {
+        fprintf(stderr, "[%10.3f ms] watchdog timeout, no wdt_reset() for %u ms\n", clockUs / 1000.0, wdtTimeout / 1000);
+        MCUSR |= 1 << WDRF;
+        wdtCount++;
+        wdtDeadline = clockUs + wdtTimeout;
+    }
+}
+
+//---------------------------------------------------------
+// ADC with NTC voltage dividers
+
+struct Ntc {
+    bool  present;
+    bool  connected;
+    float temperature;
+};
+
+Ntc      ntc[8];
+bool     adcBusy;
+uint64_t adcDone;
+uint32_t adcNoise = 12345;
+
+uint16_t adcValue(uint8_t channel)
+{
+    if (!ntc[channel].present || !ntc[channel].connected) {
+        return 0;    // input pulled to Gnd by the 10k resistor
+    }
+    // Steinhart-Hart of the 10k NTC of the example circuit (NTC_10K_SH) solved for ln(R)
+    const double A = 0.001129148, B = 0.000234125, C = 0.0000000876741;
+    double       y = 1.0 / (ntc[channel].temperature + 273.15);
+    double       x = (y - A) / B;
+    for (uint8_t i = 0; i < 8; i++) {
+        x = x - (A + B * x + C * x * x * x - y) / (B + 3 * C * x * x);
+    }
+    double rNtc  = exp(x);
+    double value = 1024.0 * 10000.0 / (10000.0 + rNtc);
+    adcNoise     = adcNoise * 1103515245 + 12345;    // +-1 LSB noise, oversampling averages it
+    value += (int)((adcNoise >> 16) % 3) - 1;
+    return (uint16_t)constrain(value, 0.0, 1023.0);
+}
+
+void adcRun()
+{
+    if (adcBusy && (adcDone <= clockUs)) {
+        adcBusy = false;
+        ADC     = adcValue(ADMUX & 0x07);
+        ADCSRA  = (ADCSRA & ~(1 << ADSC)) | (1 << ADIF);
+    }
+    if (!adcBusy && (ADCSRA & (1 << ADEN)) && (ADCSRA & (1 << ADSC))) {
+        uint8_t  prescaler = ((ADCSRA & 0x07) == 0) ? 2 : (1 << (ADCSRA & 0x07));
+        uint32_t cycles    = ADC_CYCLES * prescaler;
+        adcBusy            = true;
+        adcDone            = clockUs + (cycles + F_CPU / 1000000 - 1) / (F_CPU / 1000000);
+    }
+}
+
+//---------------------------------------------------------
+// DS18B20 sensors
+
+struct Ds18b20 {
+    uint8_t  pin;
+    uint8_t  rom[8];
+    bool     connected;
+    float    temperature;
+    uint8_t  th, tl, cfg;
+    int16_t  raw;    // conversion result
+    bool     converting;
+    uint64_t conversionDone;
+};
+
+std::vector<Ds18b20> ds18b20;
+
+void ds18b20Latch(Ds18b20& s)
+{
+    if (s.converting && (clockUs >= s.conversionDone)) {
+        s.converting      = false;
+        uint8_t resolution = 9 + ((s.cfg >> 5) & 0x03);
+        int16_t raw        = (int16_t)lround(s.temperature * 16.0f);
+        s.raw              = raw & ~((1 << (12 - resolution)) - 1);
+    }
+}
+
+// search order of the 1-wire search algorithm: ROM bits from bit 0, 0 first
+bool romLess(const uint8_t* a, const uint8_t* b)
+{
+    for (uint8_t i = 0; i < 64; i++) {
+        uint8_t bitA = (a[i / 8] >> (i % 8)) & 1;
+        uint8_t bitB = (b[i / 8] >> (i % 8)) & 1;
+        if (bitA != bitB) {
+            return bitA < bitB;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------
+// fans
+
+struct Fan {
+    uint8_t  output;
+    uint8_t  tachPin;
+    uint8_t  pulses;
+    bool     inverted;
+    uint16_t maxRpm;
+    float    rpm;
+    bool     level;
+    uint64_t nextEdge;
+    uint64_t lastUpdate;
+};
+
+std::vector<Fan> fans;
+
+// duty cycle at the fan pwm input
+float fanInput(const Fan& f)
+{
+    float pin = 0.0f;
+    if (f.output <= 1) {    // Timer1, phase correct pwm, TOP = ICR1
+        bool enabled = (f.output == 0) ? (TCCR1A & (1 << COM1A1)) : (TCCR1A & (1 << COM1B1));
+        uint16_t ocr = (f.output == 0) ? OCR1A : OCR1B;
+        if (enabled && (ICR1 > 0)) {
+            pin = (ocr >= ICR1) ? 1.0f : (float)ocr / ICR1;
+        } else {
+            pin = (*portRegister((f.output == 0) ? 9 : 10) & pinMask((f.output == 0) ? 9 : 10)) ? 1.0f : 0.0f;
+        }
+    } else {    // Timer2, fast pwm, TOP = OCR2A
+        if (TCCR2A & (1 << COM2B1)) {
+            pin = (OCR2B >= OCR2A) ? 1.0f : (OCR2B + 1.0f) / (OCR2A + 1.0f);
+        } else {
+            pin = (PORTD & pinMask(3)) ? 1.0f : 0.0f;
+        }
+    }
+    return f.inverted ? 1.0f - pin : pin;
+}
+
+void fanSpeed(Fan& f)
+{
+    float duty   = fanInput(f);
+    float target = f.maxRpm * ((duty < SIM_FAN_MIN_DUTY) ? SIM_FAN_MIN_DUTY : duty);
+    float dt     = (clockUs - f.lastUpdate) / 1000000.0f;
+    f.rpm += (target - f.rpm) * (1.0f - expf(-dt / FAN_TIME_CONSTANT));
+    f.lastUpdate = clockUs;
+}
+
+void fanRun()
+{
+    for (Fan& f : fans) {
+        while (f.nextEdge <= clockUs) {
+            uint64_t edge = f.nextEdge;
+            fanSpeed(f);
+            if (f.rpm < FAN_MIN_RPM) {
+                f.level = true;
+                setPinLevel(f.tachPin, true);
+                f.nextEdge = edge + FAN_IDLE_POLL;
+            } else {
+                f.level = !f.level;
+                setPinLevel(f.tachPin, f.level);
+                f.nextEdge = edge + (uint64_t)(30000000.0f / (f.rpm * f.pulses));    // half tach period
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------
+// interrupts
+
+void call(void (*handler)(void))
+{
+    uint8_t sreg = SREG;
+    SREG &= ~(1 << SREG_I);
+    handler();
+    SREG = sreg;    // reti
+}
+
+// pending interrupts in the order of the vector table
+void dispatch()
+{
+    bool pending = true;
+    while (pending && (SREG & (1 << SREG_I))) {
+        pending = false;
+        for (uint8_t i = 0; i < 2; i++) {
+            if (intFlag[i]) {
+                intFlag[i] = false;
+                if (intHandler[i]) {
+                    call(intHandler[i]);
+                }
+                pending = true;
+            }
+        }
+        void (*pcint[3])(void) = { PCINT0_vect, PCINT1_vect, PCINT2_vect };
+        for (uint8_t i = 0; i < 3; i++) {
+            if ((PCIFR & (1 << i)) && (PCICR & (1 << i))) {
+                PCIFR &= ~(1 << i);
+                if (pcint[i]) {
+                    call(pcint[i]);
+                }
+                pending = true;
+            }
+        }
+        if ((ADCSRA & (1 << ADIF)) && (ADCSRA & (1 << ADIE))) {
+            ADCSRA &= ~(1 << ADIF);
+            if (ADC_vect) {
+                call(ADC_vect);
+            }
+            pending = true;
+        }
+    }
+}
+
+uint64_t nextEvent()
+{
+    uint64_t t = UINT64_MAX;
+    if (!uartHostQueue.empty()) {
+        t = min(t, uartHostQueue.front().time);
+    }
+    if (uartTxBusy) {
+        t = min(t, uartTxDone);
+    }
+    if (adcBusy) {
+        t = min(t, adcDone);
+    }
+    for (const Fan& f : fans) {
+        t = min(t, f.nextEdge);
+    }
+    return t;
+}
+
+void runModels()
+{
+    uartRun();
+    eepromRun();
+    adcRun();
+    fanRun();
+    wdtRun();
+}
+
+}
+
+//---------------------------------------------------------
+namespace sim {
+
+uint64_t now()
+{
+    return clockUs;
+}
+
+void advance(uint32_t us)
+{
+    uint64_t end = clockUs + us;
+    if (busy) {
+        clockUs = end;
+        return;
+    }
+    busy = true;
+    runModels();
+    busy = false;
+    dispatch();
+    while (true) {
+        busy      = true;
+        uint64_t t = nextEvent();
+        if (t > end) {
+            break;
+        }
+        clockUs = max(clockUs, t);
+        runModels();
+        busy = false;
+        dispatch();
+    }
+    clockUs = max(clockUs, end);
+    runModels();
+    busy = false;
+    dispatch();
+}
+
+uint64_t hostWrite(const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        uartHostLast = max(uartHostLast, clockUs) + uartByteTime(uartHostBaud);
+        uartHostQueue.push_back({ uartHostLast, data[i], uartHostBaud });
+    }
+    return uartHostLast;
+}
+
+void setTxHandler(TxHandler handler)
+{
+    uartTxHandler = handler;
+}
+
+uint32_t baudRate()
+{
+    return uartBaud;
+}
+
+void setHostBaud(uint32_t baud)
+{
+    uartHostBaud = baud;
+}
+
+bool eepromLoad(const char* path)
+{
+    memset(eepromData, 0xFF, sizeof(eepromData));
+    if (!path) {
+        return false;
+    }
+    eepromFile = fopen(path, "r+b");
+    if (eepromFile) {
+        size_t n = fread(eepromData, 1, sizeof(eepromData), eepromFile);
+        (void)n;
+    } else {
+        eepromFile = fopen(path, "w+b");
+        if (eepromFile) {
+            fwrite(eepromData, 1, sizeof(eepromData), eepromFile);
+            fflush(eepromFile);
+        }
+    }
+    return eepromFile != NULL;
+}
+
+uint8_t addDs18b20(uint8_t pin)
+{
+    Ds18b20 s;
+    uint8_t n = ds18b20.size();
+    s.pin     = pin;
+    s.rom[0]  = 0x28;
+    s.rom[1]  = 0x10 + n;    // serial number
+    s.rom[2]  = pin;
+    s.rom[3]  = 0xA5;
+    s.rom[4]  = 0x5A;
+    s.rom[5]  = 0x00;
+    s.rom[6]  = 0x00;
+    s.rom[7]  = OneWire::crc8(s.rom, 7);
+    s.connected      = true;
+    s.temperature    = 25.0f;
+    s.th             = 0x4B;
+    s.tl             = 0x46;
+    s.cfg            = 0x7F;      // 12 bit
+    s.raw            = 0x0550;    // power on value 85C
+    s.converting     = false;
+    s.conversionDone = 0;
+    ds18b20.push_back(s);
+    return n;
+}
+
+void addNtc(uint8_t channel)
+{
+    if (channel < 8) {
+        ntc[channel].present     = true;
+        ntc[channel].connected   = true;
+        ntc[channel].temperature = 25.0f;
+    }
+}
+
+void setTemperature(uint8_t n, float celsius)
+{
+    if (n < ds18b20.size()) {
+        ds18b20[n].temperature = celsius;
+    }
+    if (n < 8) {
+        ntc[n].temperature = celsius;
+    }
+}
+
+void setConnected(uint8_t n, bool connected)
+{
+    if (n < ds18b20.size()) {
+        ds18b20[n].connected = connected;
+    }
+    if (n < 8) {
+        ntc[n].connected = connected;
+    }
+}
+
+uint8_t addFan(uint8_t output, uint8_t tachPin, uint16_t maxRpm, uint8_t pulses, bool inverted)
+{
+    Fan f;
+    f.output     = output;
+    f.tachPin    = tachPin;
+    f.pulses     = (pulses > 0) ? pulses : 2;
+    f.inverted   = inverted;
+    f.maxRpm     = maxRpm;
+    f.rpm        = 0.0f;
+    f.level      = true;
+    f.nextEdge   = clockUs;
+    f.lastUpdate = clockUs;
+    setPinLevel(tachPin, true);
+    fans.push_back(f);
+    return fans.size() - 1;
+}
+
+void setFanMaxRpm(uint8_t n, uint16_t maxRpm)
+{
+    if (n < fans.size()) {
+        fanSpeed(fans[n]);
+        fans[n].maxRpm = maxRpm;
+    }
+}
+
+uint16_t fanRpm(uint8_t n)
+{
+    return (n < fans.size()) ? (uint16_t)(fans[n].rpm + 0.5f) : 0;
+}
+
+float fanDuty(uint8_t n)
+{
+    return (n < fans.size()) ? fanInput(fans[n]) : 0.0f;
+}
+
+uint8_t fanCount()
+{
+    return fans.size();
+}
+
+uint32_t watchdogTimeouts()
+{
+    return wdtCount;
+}
+
+uint64_t sleepTime()
+{
+    return sleepUs;
+}
+
+}
+
+//---------------------------------------------------------
+// Arduino core
+
+unsigned long millis()
+{
+    sim::advance(SIM_CALL_TIME);
+    return clockUs / 1000;
+}
+
+unsigned long micros()
+{
+    sim::advance(SIM_CALL_TIME);
+    return clockUs;
+}
+
+void delay(unsigned long ms)
+{
+    sim::advance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    sim::advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (mode == OUTPUT) {
+        *ddrRegister(pin) |= pinMask(pin);
+        setPinLevel(pin, (*portRegister(pin) & pinMask(pin)) != 0);
+    } else {
+        *ddrRegister(pin) &= ~pinMask(pin);
+        if (mode == INPUT_PULLUP) {
+            *portRegister(pin) |= pinMask(pin);
+        } else {
+            *portRegister(pin) &= ~pinMask(pin);
+        }
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (val) {
+        *portRegister(pin) |= pinMask(pin);
+    } else {
+        *portRegister(pin) &= ~pinMask(pin);
+    }
+    if (*ddrRegister(pin) & pinMask(pin)) {
+        setPinLevel(pin, val);
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    return (*pinRegister(pin) & pinMask(pin)) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+    uint8_t channel = (pin >= A0) ? pin - A0 : pin;
+    sim::advance(ADC_CYCLES * 128 / (F_CPU / 1000000));
+    return adcValue(channel & 0x07);
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode)
+{
+    if (interruptNum < 2) {
+        intHandler[interruptNum] = userFunc;
+        intMode[interruptNum]    = mode;
+        intFlag[interruptNum]    = false;
+    }
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+    if (interruptNum < 2) {
+        intHandler[interruptNum] = NULL;
+    }
+}
+
+void wdt_enable(uint8_t timeout)
+{
+    wdtTimeout  = 15000UL << timeout;
+    wdtDeadline = clockUs + wdtTimeout;
+}
+
+void wdt_disable()
+{
+    wdtTimeout = 0;
+}
+
+void wdt_reset()
+{
+    wdtDeadline = clockUs + wdtTimeout;
+}
+
+//---------------------------------------------------------
+// idle sleep, any interrupt source wakes the CPU
+
+void sleep_cpu()
+{
+    if (!(SMCR & (1 << SE))) {
+        return;
+    }
+    uint64_t wake = min(nextEvent(), (clockUs / TIMER0_OVF_TIME + 1) * TIMER0_OVF_TIME);
+    if (wake > clockUs) {
+        sleepUs += wake - clockUs;
+        sim::advance(wake - clockUs);
+    }
+}
+
+//---------------------------------------------------------
+// Print, HardwareSerial
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+size_t Print::print(long n, int base)
+{
+    if ((n < 0) && (base == DEC)) {
+        return print('-') + print((unsigned long)-n, base);
+    }
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char  buf[8 * sizeof(long) + 1];
+    char* str = &buf[sizeof(buf) - 1];
+    *str      = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        char c = n % base;
+        n /= base;
+        *--str = (c < 10) ? c + '0' : c + 'A' - 10;
+    } while (n);
+    return print(str);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    uartBaud = baud;
+}
+
+void HardwareSerial::end()
+{
+    flush();
+}
+
+int HardwareSerial::available()
+{
+    return uartRx.size();
+}
+
+int HardwareSerial::peek()
+{
+    return uartRx.empty() ? -1 : uartRx.front();
+}
+
+int HardwareSerial::read()
+{
+    if (uartRx.empty()) {
+        return -1;
+    }
+    uint8_t c = uartRx.front();
+    uartRx.pop_front();
+    return c;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return UART_BUFFER_SIZE - 1 - uartTx.size();
+}
+
+void HardwareSerial::flush()
+{
+    while (uartTxBusy) {
+        sim::advance(uartTxDone - clockUs);
+    }
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    UCSR0A &= ~(1 << TXC0);
+    if (!uartTxBusy) {
+        uartTxBusy = true;
+        uartTxByte = c;
+        uartTxDone = clockUs + uartByteTime();
+        return 1;
+    }
+    // buffer full: the Arduino core waits, inside interrupt handlers it polls the UART
+    while (uartTx.size() >= UART_BUFFER_SIZE - 1) {
+        sim::advance(uartTxDone - clockUs);
+        if (busy) {
+            uartRun();
+        }
+    }
+    uartTx.push_back(c);
+    return 1;
+}
+
+//---------------------------------------------------------
+// EEPROM library
+
+uint8_t simEepromRead(uint16_t addr)
+{
+    eepromWait();
+    return eepromData[addr & E2END];
+}
+
+void simEepromWrite(uint16_t addr, uint8_t value)
+{
+    // eeprom_write_byte() waits for the previous write, then starts the write and returns
+    eepromWait();
+    eepromData[addr & E2END] = value;
+    eepromBusyUntil          = clockUs + EEPROM_WRITE_TIME;
+    EECR |= 1 << EEPE;
+    if (eepromFile) {
+        fseek(eepromFile, addr & E2END, SEEK_SET);
+        fputc(value, eepromFile);
+        fflush(eepromFile);
+    }
+}
+
+//---------------------------------------------------------
+// OneWire library, byte level model of the DS18B20 commands
+
+uint8_t OneWire::reset()
+{
+    sim::advance(ONEWIRE_RESET_TIME);
+    _state    = StateRom;
+    _selected = 0;
+    _count    = 0;
+    for (const Ds18b20& s : ds18b20) {
+        if ((s.pin == _pin) && s.connected) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void OneWire::select(const uint8_t rom[8])
+{
+    write(0x55);
+    for (uint8_t i = 0; i < 8; i++) {
+        write(rom[i]);
+    }
+}
+
+void OneWire::skip()
+{
+    write(0xCC);
+}
+
+void OneWire::write(uint8_t v, uint8_t power)
+{
+    (void)power;
+    sim::advance(8 * ONEWIRE_SLOT_TIME);
+
+    switch (_state) {
+    case StateRom:
+        if (v == 0xCC) {    // skip ROM: all devices
+            for (uint8_t i = 0; i < ds18b20.size(); i++) {
+                if ((ds18b20[i].pin == _pin) && ds18b20[i].connected) {
+                    _selected |= 1UL << i;
+                }
+            }
+            _state = StateFunction;
+        } else if (v == 0x55) {    // match ROM
+            _count = 0;
+            _state = StateMatch;
+        } else {
+            _state = StateIdle;
+        }
+        break;
+    case StateMatch:
+        _rom[_count++] = v;
+        if (_count == 8) {
+            for (uint8_t i = 0; i < ds18b20.size(); i++) {
+                if ((ds18b20[i].pin == _pin) && ds18b20[i].connected && (memcmp(ds18b20[i].rom, _rom, 8) == 0)) {
+                    _selected |= 1UL << i;
+                }
+            }
+            _state = StateFunction;
+        }
+        break;
+    case StateFunction:
+        _state = StateIdle;
+        for (uint8_t i = 0; i < ds18b20.size(); i++) {
+            if (!(_selected & (1UL << i))) {
+                continue;
+            }
+            Ds18b20& s = ds18b20[i];
+            ds18b20Latch(s);
+            if (v == 0x44) {    // convert T
+                s.converting     = true;
+                s.conversionDone = clockUs + (750000UL >> (3 - ((s.cfg >> 5) & 0x03)));
+            }
+        }
+        if (v == 0xBE) {    // read scratchpad, several devices answer wired-AND
+            memset(_data, 0xFF, sizeof(_data));
+            for (uint8_t i = 0; i < ds18b20.size(); i++) {
+                if (_selected & (1UL << i)) {
+                    const Ds18b20& s = ds18b20[i];
+                    uint8_t        d[9] = { (uint8_t)(s.raw & 0xFF), (uint8_t)(s.raw >> 8), s.th, s.tl, s.cfg, 0xFF, 0x0C, 0x10, 0 };
+                    d[8] = crc8(d, 8);
+                    for (uint8_t j = 0; j < 9; j++) {
+                        _data[j] &= d[j];
+                    }
+                }
+            }
+            _count = 0;
+            _state = StateRead;
+        } else if (v == 0x4E) {    // write scratchpad: TH, TL, configuration
+            _count = 0;
+            _state = StateWrite;
+        }
+        break;
+    case StateWrite:
+        for (uint8_t i = 0; i < ds18b20.size(); i++) {
+            if (_selected & (1UL << i)) {
+                Ds18b20& s = ds18b20[i];
+                if (_count == 0) {
+                    s.th = v;
+                } else if (_count == 1) {
+                    s.tl = v;
+                } else if (_count == 2) {
+                    s.cfg = (v & 0x60) | 0x1F;
+                }
+            }
+        }
+        if (++_count >= 3) {
+            _state = StateIdle;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void OneWire::write_bytes(const uint8_t* buf, uint16_t count, bool power)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        write(buf[i], power);
+    }
+}
+
+uint8_t OneWire::read()
+{
+    sim::advance(8 * ONEWIRE_SLOT_TIME);
+    if ((_state == StateRead) && (_count < 9)) {
+        return _data[_count++];
+    }
+    return 0xFF;
+}
+
+void OneWire::read_bytes(uint8_t* buf, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        buf[i] = read();
+    }
+}
+
+void OneWire::write_bit(uint8_t v)
+{
+    (void)v;
+    sim::advance(ONEWIRE_SLOT_TIME);
+}
+
+// a converting device holds the bus low during read slots
+uint8_t OneWire::read_bit()
+{
+    sim::advance(ONEWIRE_SLOT_TIME);
+    for (uint8_t i = 0; i < ds18b20.size(); i++) {
+        if (_selected & (1UL << i)) {
+            ds18b20Latch(ds18b20[i]);
+            if (ds18b20[i].converting && ds18b20[i].connected) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void OneWire::reset_search()
+{
+    memset(_searchLast, 0, sizeof(_searchLast));
+    _searchDone   = false;
+    _searchFamily = 0;
+}
+
+void OneWire::target_search(uint8_t family_code)
+{
+    reset_search();
+    _searchFamily = family_code;
+}
+
+// same sequence as the OneWire library: devices in ROM bit order, false after the last device, then the search restarts
+bool OneWire::search(uint8_t* newAddr, bool search_mode)
+{
+    (void)search_mode;
+    bool    first = (_searchLast[0] == 0);
+    uint8_t found = 0xFF;
+    if (!_searchDone && reset()) {
+        sim::advance(64 * 3 * ONEWIRE_SLOT_TIME);
+        for (uint8_t i = 0; i < ds18b20.size(); i++) {
+            const Ds18b20& s = ds18b20[i];
+            if ((s.pin != _pin) || !s.connected || ((_searchFamily != 0) && (s.rom[0] != _searchFamily))) {
+                continue;
+            }
+            if ((first || romLess(_searchLast, s.rom)) && ((found == 0xFF) || romLess(s.rom, ds18b20[found].rom))) {
+                found = i;
+            }
+        }
+    }
+    _state = StateIdle;
+    if (found == 0xFF) {
+        reset_search();
+        return false;
+    }
+    memcpy(_searchLast, ds18b20[found].rom, 8);
+    memcpy(newAddr, ds18b20[found].rom, 8);
+
+    // last device flag
+    _searchDone = true;
+    for (const Ds18b20& s : ds18b20) {
+        if ((s.pin == _pin) && s.connected && ((_searchFamily == 0) || (s.rom[0] == _searchFamily)) && romLess(_searchLast, s.rom)) {
+            _searchDone = false;
+        }
+    }
+    return true;
+}
+
+uint8_t OneWire::crc8(const uint8_t* addr, uint8_t len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc = _crc_ibutton_update(crc, *addr++);
+    }
+    return crc;
+}
@@ -0,0 +1,72 @@
+//---------------------------------------------------------
+// Argus Controller (Open Hardware)
+// sim.h - Linux simulation backend
+// Copyright 2020-2023 Argotronic GmbH
+//
+// License: CC BY-SA 4.0
+// https://creativecommons.org/licenses/by-sa/4.0/
+// You are free to Share & Adapt under the following terms:
+// Give Credit, ShareAlike
+//---------------------------------------------------------
+// Hardware models behind the Arduino API of the simulation:
+// virtual clock, interrupts, UART, EEPROM, DS18B20 1-wire sensors, NTC/ADC,
+// pwm timers and fans with tach output
+//---------------------------------------------------------
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace sim {
+
+// virtual clock in us, every millis()/micros() call costs SIM_CALL_TIME
+#define SIM_CALL_TIME 1
+
+uint64_t now();
+
+// advance the virtual clock, runs the hardware models and the enabled interrupt handlers
+void advance(uint32_t us);
+
+// host side of the UART, device bytes are passed to the handler when their stop bit is sent
+// hostWrite returns the arrival time of the last byte
+typedef void (*TxHandler)(uint8_t data);
+uint64_t hostWrite(const uint8_t* data, size_t len);
+void     setTxHandler(TxHandler handler);
+uint32_t baudRate();
+void     setHostBaud(uint32_t baud);    // 0 = the host follows the device, bytes at different baud rates are lost
+
+// file backed EEPROM, 0xFF when the file does not exist, without a path erased and not saved (returns false)
+bool eepromLoad(const char* path);
+
+// DS18B20 sensor on a 1-wire pin, returns the sensor number
+uint8_t addDs18b20(uint8_t pin);
+
+// 10k NTC (to Vcc) with 10k resistor to Gnd on an ADC channel, see ntcsensor.h
+void addNtc(uint8_t channel);
+
+// temperature of sensor n: DS18B20 sensor n and NTC on ADC channel n
+void setTemperature(uint8_t n, float celsius);
+
+// disconnected DS18B20 sensors do not answer, disconnected NTCs read as open input
+void setConnected(uint8_t n, bool connected);
+
+// fan with pwm input on output FANPWM_x and open collector tach output on a pin
+// maxRpm: rpm at 100% pwm, 0 = blocked rotor, below SIM_FAN_MIN_DUTY the fan keeps its min. speed
+#define SIM_FAN_MIN_DUTY 0.2f
+uint8_t  addFan(uint8_t output, uint8_t tachPin, uint16_t maxRpm, uint8_t pulses, bool inverted);
+void     setFanMaxRpm(uint8_t n, uint16_t maxRpm);
+uint16_t fanRpm(uint8_t n);
+float    fanDuty(uint8_t n);
+uint8_t  fanCount();
+
+// hardware watchdog timeouts since the start
+uint32_t watchdogTimeouts();
+
+// us spent in sleep_cpu() since the start
+uint64_t sleepTime();
+
+}
+
+#endif
@@ -0,0 +1,31 @@
+#---------------------------------------------------------
+# Argus Controller (Open Hardware)
+# sketch.cmake - generates sketch.cpp from the .ino file
+#
+# cmake -DINO=<sketch.ino> -DOUT=<sketch.cpp> [-DTEMP_CHANNELS=<descriptors>] -P sketch.cmake
+#---------------------------------------------------------
+
+# function definitions at the start of a line, e.g. "void cmdGetTemp(uint32_t qdata)"
+# file(STRINGS) splits at ';', prototypes and statements never match because of the required closing ')'
+file(STRINGS ${INO} LINES)
+set(PROTOTYPES "")
+foreach(LINE IN LISTS LINES)
+    if(LINE MATCHES "^([A-Za-z_][A-Za-z_0-9<>:*&]*[ \t]+)+[*&]?[A-Za-z_][A-Za-z_0-9]*\\([^;{}]*\\)[ \t]*$")
+        if(NOT LINE MATCHES "^(else|return|if|while|for|switch)[ \t(]")
+            string(APPEND PROTOTYPES "${LINE};\n")
+        endif()
+    endif()
+endforeach()
+
+# TEMP_CHANNELS: variant with other temperature channels, the sketch is copied with a replaced TEMP_CHANNELS line
+set(SKETCH ${INO})
+if(DEFINED TEMP_CHANNELS)
+    string(REGEX REPLACE "\\.cpp$" ".ino" SKETCH ${OUT})
+    file(READ ${INO} TEXT)
+    string(REGEX REPLACE "\n#define TEMP_CHANNELS [^\n]*" "\n#define TEMP_CHANNELS ${TEMP_CHANNELS}" TEXT "${TEXT}")
+    file(WRITE ${SKETCH}.tmp "${TEXT}")
+    execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${SKETCH}.tmp ${SKETCH})
+endif()
+
+file(WRITE ${OUT}.tmp "// generated from ${INO}\n#include <Arduino.h>\n\n${PROTOTYPES}\n#include \"${SKETCH}\"\n")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUT}.tmp ${OUT})